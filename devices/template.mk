@@ -7,6 +7,8 @@ CC=avr-gcc
 
 LIBRARY_OBJECT_FILES=\
 	OrangutanAnalog.o \
+	OrangutanAnalogScan.o \
+	OrangutanAnalogTimed.o \
 	OrangutanBuzzer.o \
 	OrangutanDigital.o \
 	OrangutanLCD.o \
@@ -16,6 +18,8 @@ LIBRARY_OBJECT_FILES=\
 	OrangutanPushbuttons.o \
 	OrangutanResources.o \
 	OrangutanSerial.o \
+	OrangutanSerialFraming.o \
+	OrangutanSerialCommands.o \
 	OrangutanServos.o \
 	OrangutanSPIMaster.o \
 	OrangutanTime.o \
@@ -23,6 +27,8 @@ LIBRARY_OBJECT_FILES=\
 	OrangutanX2.o \
 	Pololu3pi.o \
 	PololuQTRSensors.o \
+	PololuQTRSensorsAnalogScan.o \
+	PololuQTRSensorsRCAsync.o \
 	PololuWheelEncoders.o
 
 LIBRARY = ../../libpololu_$(DEVICE).a
@@ -34,6 +40,21 @@ $(LIBRARY): $(LIBRARY_OBJECT_FILES)
 %.o:$(SRC)/$$*/%.cpp $(SRC)/$$*/%.h
 	$(CPP) $(CFLAGS) $(SRC)/$*/$< -c -o $@
 
+# These objects are kept separate from their module's main object so that
+# the interrupt service routines they define are only linked when needed.
+OrangutanAnalogScan.o: $(SRC)/OrangutanAnalog/OrangutanAnalogScan.cpp $(SRC)/OrangutanAnalog/OrangutanAnalog.h
+	$(CPP) $(CFLAGS) $< -c -o $@
+OrangutanAnalogTimed.o: $(SRC)/OrangutanAnalog/OrangutanAnalogTimed.cpp $(SRC)/OrangutanAnalog/OrangutanAnalog.h
+	$(CPP) $(CFLAGS) $< -c -o $@
+PololuQTRSensorsRCAsync.o: $(SRC)/PololuQTRSensors/PololuQTRSensorsRCAsync.cpp $(SRC)/PololuQTRSensors/PololuQTRSensors.h
+	$(CPP) $(CFLAGS) $< -c -o $@
+PololuQTRSensorsAnalogScan.o: $(SRC)/PololuQTRSensors/PololuQTRSensorsAnalogScan.cpp $(SRC)/PololuQTRSensors/PololuQTRSensors.h
+	$(CPP) $(CFLAGS) $< -c -o $@
+
+# Kept separate so that the frame decoders are only linked when used.
+OrangutanSerialFraming.o: $(SRC)/OrangutanSerial/OrangutanSerialFraming.cpp $(SRC)/OrangutanSerial/OrangutanSerial.h
+	$(CPP) $(CFLAGS) $< -c -o $@
+
 clean:
 	rm -f $(LIBRARY_OBJECT_FILES) *.a *.hex *.obj
 	rm -rf examples/hex-files
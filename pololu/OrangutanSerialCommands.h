@@ -0,0 +1 @@
+#include "OrangutanSerialCommands/OrangutanSerialCommands.h"
@@ -9,6 +9,7 @@
 #include "PololuWheelEncoders/PololuWheelEncoders.h"
 #include "OrangutanResources/OrangutanResources.h"
 #include "OrangutanSerial/OrangutanSerial.h"
+#include "OrangutanSerialCommands/OrangutanSerialCommands.h"
 #include "OrangutanDigital/OrangutanDigital.h"
 #include "OrangutanServos/OrangutanServos.h"
 #include "OrangutanPulseIn/OrangutanPulseIn.h"
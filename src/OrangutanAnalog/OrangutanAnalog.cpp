@@ -29,6 +29,26 @@
 #include "../OrangutanResources/include/OrangutanModel.h"
 
 
+extern "C" void set_analog_mode(unsigned char mode)
+{
+	OrangutanAnalog::setMode(mode);
+}
+
+extern "C" unsigned char get_analog_mode()
+{
+	return OrangutanAnalog::getMode();
+}
+
+extern "C" void set_analog_profile(unsigned char profile)
+{
+	OrangutanAnalog::setProfile(profile);
+}
+
+extern "C" unsigned char get_analog_profile()
+{
+	return OrangutanAnalog::getProfile();
+}
+
 extern "C" unsigned int analog_read(unsigned char channel)
 {
 	return OrangutanAnalog::read(channel);
@@ -135,6 +155,24 @@ extern "C" int read_temperature_c()
 
 #ifdef _ORANGUTAN_SVP
 static unsigned int fromMillivoltsToNormal(unsigned int millivolts);
+
+// returns the average of 'samples' readings of one of the auxiliary
+// processor's channels in millivolts
+static unsigned int readAuxiliaryMillivolts(unsigned char channel, unsigned int samples)
+{
+	SVPAnalogReadings readings;
+	OrangutanSVP::getAnalogMillivolts(&readings, samples);
+
+	switch (channel)
+	{
+		case TRIMPOT: return readings.trimpot;
+		case CHANNEL_A: return readings.channelA;
+		case CHANNEL_B: return readings.channelB;
+		case CHANNEL_C: return readings.channelC;
+		case CHANNEL_D: return readings.channelD;
+	}
+	return 0;
+}
 #endif
 
 
@@ -153,7 +191,47 @@ static unsigned char adc_result_is_in_millivolts = 0;
 static unsigned int adc_result_millivolts;
 #endif
 
-static unsigned int millivolt_calibration = 5000;	// contains VCC in millivolts
+// Q16 fixed-point factors for converting between ADC results and
+// millivolts.  They are computed from the VCC calibration (5000 mV by
+// default) by setMillivoltCalibration() so that the conversions are a
+// multiplication and a shift instead of a division.  The 10-bit factors are also used in
+// the oversampled modes, with the shift adjusted by extra_bits.
+#define Q16_RATIO(a, b)	(((unsigned long)(a) * 65536 + (b) / 2) / (b))
+static unsigned long millivolts_per_count_8 = Q16_RATIO(5000, 255);
+static unsigned long millivolts_per_count_10 = Q16_RATIO(5000, 1023);
+#ifdef _ORANGUTAN_SVP
+static unsigned long counts_per_millivolt_8 = Q16_RATIO(255, 5000);
+static unsigned long counts_per_millivolt_10 = Q16_RATIO(1023, 5000);
+#endif
+
+// the number of bits of resolution added by oversampling: 1 in 11-bit mode,
+// 2 in 12-bit mode, and 0 otherwise
+static unsigned char extra_bits = 0;
+
+// the value written to ADCSRA to enable the ADC, which holds the clock
+// prescaler of the current profile
+static unsigned char adcsra_enable = 0x87;
+
+// If not 0, this does the conversion on the selected channel instead of
+// setting ADSC and polling isConverting(): it leaves the ADC idle and lets
+// the AVR's entry into ADC noise reduction sleep start the conversion.  It
+// is set by setNoiseReduction(), which is in OrangutanAnalogScan.cpp with
+// the ADC interrupt that wakes the AVR up, so that programs that do not
+// use it do not link the interrupt.
+void (*analog_conversion_sleeper)(void) = 0;
+
+// does a conversion on the channel selected by prepareConversion() and
+// waits for it to finish
+static inline void convert()
+{
+	if (analog_conversion_sleeper)
+		analog_conversion_sleeper();
+	else
+	{
+		ADCSRA |= 1 << ADSC;
+		while (OrangutanAnalog::isConverting());
+	}
+}
 
 
 // constructor
@@ -163,6 +241,60 @@ OrangutanAnalog::OrangutanAnalog()
 }
 
 
+void OrangutanAnalog::setMode(unsigned char mode)
+{
+	if (mode == MODE_10_BIT || mode == MODE_11_BIT || mode == MODE_12_BIT)
+		ADMUX &= ~(1 << ADLAR);	// right-adjust result (ADC has result)
+	else
+		ADMUX |= 1 << ADLAR;		// left-adjust result (ADCH has result)
+
+	extra_bits = 0;
+	if (mode == MODE_11_BIT)
+		extra_bits = 1;
+	else if (mode == MODE_12_BIT)
+		extra_bits = 2;
+}
+
+unsigned char OrangutanAnalog::getMode()
+{
+	if (extra_bits)
+		return extra_bits == 1 ? MODE_11_BIT : MODE_12_BIT;
+	return (ADMUX >> ADLAR) & 1;
+}
+
+void OrangutanAnalog::setProfile(unsigned char profile)
+{
+	unsigned char value = 0x87;		// prescaler 128
+	if (profile == ADC_PROFILE_BALANCED)
+		value = 0x86;				// prescaler 64
+	else if (profile == ADC_PROFILE_FAST)
+		value = 0x85;				// prescaler 32
+
+	if (value == adcsra_enable)
+		return;
+	adcsra_enable = value;
+
+	// Changing the ADC clock during a conversion corrupts it, and the first
+	// conversion at the new clock may be inaccurate, so wait for the
+	// conversion in progress and then do one to discard.
+	while (isConverting());
+	ADCSRA = adcsra_enable;
+	ADCSRA |= 1 << ADSC;
+	while (isConverting());
+}
+
+unsigned char OrangutanAnalog::getProfile()
+{
+	return 0x87 - adcsra_enable;
+}
+
+unsigned char OrangutanAnalog::getADCSRA()
+{
+	return adcsra_enable;
+}
+
+
+
 // returns the result of the previous ADC conversion.
 unsigned int OrangutanAnalog::conversionResult()
 {
@@ -173,13 +305,13 @@ unsigned int OrangutanAnalog::conversionResult()
 	}
 	#endif
 
-	if (getMode())				// if left-adjusted (i.e. 8-bit mode)
+	if (getMode() == MODE_8_BIT)	// if left-adjusted
 	{
 		return ADCH;			// 8-bit result
 	}
 	else
 	{
-		return ADC;				// 10-bit result
+		return ADC << extra_bits;	// 10-bit result, scaled to the current mode
 	}
 }
 
@@ -193,28 +325,13 @@ unsigned int OrangutanAnalog::conversionResultMillivolts()
 	}
 	#endif
 
-	if (getMode())  // if left-adjusted (i.e. 8-bit mode)
-	{
-		return toMillivolts(ADCH);
-	}
-	else
-	{
-		return toMillivolts(ADC);
-	}
+	return toMillivolts(conversionResult());
 }
 
-// the following method can be used to initiate an ADC conversion
-// that runs in the background, allowing the CPU to perform other tasks
-// while the conversion is in progress.  The procedure is to start a
-// conversion on a channel with startConversion(channel), and then
-// poll isConverting in your main loop.  Once isConverting() returns
-// a zero, the result can be obtained through a call to conversionResult().
-// NOTE: Some Orangutans and 3pis have their AREF pin connected directly to VCC.
-//  On these Orangutans, you must not use the internal voltage reference as
-//  doing so will short the internal reference voltage to VCC and could damage
-//  the AVR.  It is safe to use the internal reference voltage on the
-//  Orangutan SVP.
-void OrangutanAnalog::startConversion(unsigned char channel, unsigned char use_internal_reference)
+// Sets up the ADC for a conversion on the specified channel without
+// starting it.  Returns 0 if there is nothing to convert: the SVP's
+// auxiliary channels are read right away, and invalid channels are ignored.
+static unsigned char prepareConversion(unsigned char channel, unsigned char use_internal_reference)
 {
 	#ifdef _ORANGUTAN_SVP
 	if (channel > 31)
@@ -227,7 +344,7 @@ void OrangutanAnalog::startConversion(unsigned char channel, unsigned char use_i
 		else if (channel == CHANNEL_C){ adc_result_millivolts = OrangutanSVP::getChannelCMillivolts(); }
 		else if (channel == CHANNEL_D){ adc_result_millivolts = OrangutanSVP::getChannelDMillivolts(); }
 
-		return;
+		return 0;
 	}
 
 	adc_result_is_in_millivolts = 0;
@@ -237,18 +354,18 @@ void OrangutanAnalog::startConversion(unsigned char channel, unsigned char use_i
 	// Channel numbers greater than 31 are invalid.
 	if (channel > 31)
 	{
-		return;
+		return 0;
 	}
 
 	#endif
 
-	ADCSRA = 0x87;		// bit 7 set: ADC enabled
+	ADCSRA = adcsra_enable;	// bit 7 set: ADC enabled
 						// bit 6 clear: don't start conversion
 						// bit 5 clear: disable autotrigger
 						// bit 4: ADC interrupt flag
 						// bit 3 clear: disable ADC interrupt
-						// bits 0-2 set: ADC clock prescaler is 128
-						//  128 prescaler required for 10-bit resolution when FCPU = 20 MHz
+						// bits 0-2: ADC clock prescaler of the current profile
+						//  (128 is required for 10-bit resolution when FCPU = 20 MHz)
 						
 	// NOTE: it is important to make changes to a temporary variable and then set the ADMUX
 	// register in a single atomic operation rather than incrementally changing bits of ADMUX.
@@ -276,22 +393,46 @@ void OrangutanAnalog::startConversion(unsigned char channel, unsigned char use_i
 	tempADMUX &= ~0x1F;		 // clear channel selection bits of ADMUX
 	tempADMUX |= channel;    // we only get this far if channel is less than 32
 	ADMUX = tempADMUX;
-	ADCSRA |= 1 << ADSC; // start the conversion
+	return 1;
+}
+
+// the following method can be used to initiate an ADC conversion
+// that runs in the background, allowing the CPU to perform other tasks
+// while the conversion is in progress.  The procedure is to start a
+// conversion on a channel with startConversion(channel), and then
+// poll isConverting in your main loop.  Once isConverting() returns
+// a zero, the result can be obtained through a call to conversionResult().
+// NOTE: Some Orangutans and 3pis have their AREF pin connected directly to VCC.
+//  On these Orangutans, you must not use the internal voltage reference as
+//  doing so will short the internal reference voltage to VCC and could damage
+//  the AVR.  It is safe to use the internal reference voltage on the
+//  Orangutan SVP.
+void OrangutanAnalog::startConversion(unsigned char channel, unsigned char use_internal_reference)
+{
+	if (prepareConversion(channel, use_internal_reference))
+		ADCSRA |= 1 << ADSC; // start the conversion
 }
 
 // take a single analog reading of the specified channel
 unsigned int OrangutanAnalog::read(unsigned char channel)
 {
-	startConversion(channel);
-	while (isConverting());	// wait for conversion to finish
+	// in the oversampled modes, a reading is made of several conversions
+	if (extra_bits && channel <= 31)
+		return readAverage(channel, 1);
+
+	if (prepareConversion(channel, 0))
+		convert();
 	return conversionResult();
 }
 
 // take a single analog reading of the specified channel and return the result in millivolts
 unsigned int OrangutanAnalog::readMillivolts(unsigned char channel)
 {
-	startConversion(channel);
-	while (isConverting());	// wait for conversion to finish
+	if (extra_bits && channel <= 31)
+		return toMillivolts(readAverage(channel, 1));
+
+	if (prepareConversion(channel, 0))
+		convert();
 	return conversionResultMillivolts();
 }
 
@@ -299,30 +440,46 @@ unsigned int OrangutanAnalog::readMillivolts(unsigned char channel)
 unsigned int OrangutanAnalog::readAverage(unsigned char channel, 
 											unsigned int samples)
 {
-	unsigned int i = samples;
+	unsigned long conversions = (unsigned long)samples << (2 * extra_bits);
 	unsigned long sum = 0;
+	unsigned long divisor;
 
 #ifdef _ORANGUTAN_SVP
 	if (channel > 31)
 	{
-		// We have not implemented averaging of the adc readings from the auxiliary
-		// processor on the SVP, so we will just return a simple reading.
-		return read(channel);
+		return fromMillivoltsToNormal(readAuxiliaryMillivolts(channel, samples));
 	}
 #endif
 
-	startConversion(channel);	// call this first to set the channel
-	while (isConverting());		// wait while converting (discard first reading)
+	prepareConversion(channel, 0);	// call this first to set the channel
+	convert();					// discard the first reading
 	do
 	{
-		ADCSRA |= 1 << ADSC;	// start the next conversion on current channel
-		while (isConverting());	// wait while converting
-		sum += conversionResult();	// sum the results
-	} while (--i);
+		convert();				// the next conversion on the current channel
+		sum += (ADMUX & (1 << ADLAR)) ? ADCH : ADC;	// sum the raw results
+	} while (--conversions);
 	
-	if (samples < 64)			// can do the division much faster
+	if (extra_bits == 0 && samples < 64)	// can do the division much faster
 		return ((unsigned int)sum + (samples >> 1)) / (unsigned char)samples;
-	return (sum + (samples >> 1)) / samples;	// compute the rounded avg
+
+	// In the oversampled modes, each sample is the sum of 4^extra_bits
+	// conversions shifted right by extra_bits, so the average of the samples
+	// is the sum divided by samples << extra_bits.
+	divisor = (unsigned long)samples << extra_bits;
+	return (sum + (divisor >> 1)) / divisor;	// compute the rounded avg
+}
+
+// take 'samples' readings of the specified channel and return the average in millivolts
+unsigned int OrangutanAnalog::readAverageMillivolts(unsigned char channel, unsigned int samples)
+{
+#ifdef _ORANGUTAN_SVP
+	if (channel > 31)
+	{
+		return readAuxiliaryMillivolts(channel, samples);
+	}
+#endif
+
+	return toMillivolts(readAverage(channel, samples));
 }
 
 
@@ -332,11 +489,17 @@ unsigned int OrangutanAnalog::readAverage(unsigned char channel,
 // e.g. setMillivoltCalibration(readVCCMillivolts());
 void OrangutanAnalog::setMillivoltCalibration(unsigned int calibration)
 {
-	millivolt_calibration = calibration;
+	millivolts_per_count_8 = Q16_RATIO(calibration, 255);
+	millivolts_per_count_10 = Q16_RATIO(calibration, 1023);
+	#ifdef _ORANGUTAN_SVP
+	counts_per_millivolt_8 = Q16_RATIO(255, calibration);
+	counts_per_millivolt_10 = Q16_RATIO(1023, calibration);
+	#endif
 }
 
-// averages ten ADC readings of the fixed internal 1.1V bandgap voltage
-// and computes VCC from the results.  This function returns VCC in millivolts.
+// lets the ADC settle on the fixed internal 1.1V bandgap voltage, then
+// measures it in 12-bit mode as the average of five oversampled readings
+// and computes VCC from the result.  This function returns VCC in millivolts.
 // Channel 14 is internal 1.1V BG on ATmega48/168/328, but bit 5 of ADMUX is
 // not used, so channel 30 is equivalent to channel 14.  Channel 30 is the internal
 // 1.1V BG on ATmega324/644/1284.
@@ -350,8 +513,10 @@ unsigned int OrangutanAnalog::readVCCMillivolts()
 	// the BG voltage and gives the voltage time to settle.
 	readAverage(30, 20);
 	
-	unsigned int reading = readAverage(30, 20);  // channel 30 is internal 1.1V BG
-	unsigned int value = (1023UL * 1100UL + (reading>>1)) / reading;
+	// use 12-bit mode for the measurement itself (80 conversions)
+	setMode(MODE_12_BIT);
+	unsigned int reading = readAverage(30, 5);  // channel 30 is internal 1.1V BG
+	unsigned int value = (4092UL * 1100UL + (reading>>1)) / reading;
 	setMode(mode);
 	return value;
 }
@@ -359,10 +524,11 @@ unsigned int OrangutanAnalog::readVCCMillivolts()
 // converts the specified ADC result to millivolts
 unsigned int OrangutanAnalog::toMillivolts(unsigned int adcResult)
 {
-	unsigned long temp = adcResult * (unsigned long)millivolt_calibration;
-	if (getMode())							// if 8-bit mode
-		return (temp + 127) / 255;
-	return (temp + 511) / 1023;
+	if (ADMUX & (1 << ADLAR))	// if 8-bit mode
+		return (adcResult * millivolts_per_count_8 + 0x8000) >> 16;
+	if (extra_bits)
+		return (adcResult * millivolts_per_count_10 + (0x8000UL << extra_bits)) >> (16 + extra_bits);
+	return (adcResult * millivolts_per_count_10 + 0x8000) >> 16;
 }
 
 
@@ -371,9 +537,9 @@ static unsigned int fromMillivoltsToNormal(unsigned int millivolts)
 {
 	unsigned long temp;
 
-	if (OrangutanAnalog::getMode())  // if 8-bit mode
+	if (OrangutanAnalog::getMode() == MODE_8_BIT)
 	{
-		temp = (millivolts * 255UL + (millivolt_calibration>>1)) / millivolt_calibration;
+		temp = (millivolts * counts_per_millivolt_8 + 0x8000) >> 16;
 		if (temp > 0xFFu)
 		{
 			return 0xFFu;
@@ -381,7 +547,7 @@ static unsigned int fromMillivoltsToNormal(unsigned int millivolts)
 	}
 	else
 	{
-		temp = (millivolts * 1023UL + (millivolt_calibration>>1)) / millivolt_calibration;
+		temp = (millivolts * counts_per_millivolt_10 + (0x8000 >> extra_bits)) >> (16 - extra_bits);
 		if (temp > 0xFFFFu)
 		{
 			return 0xFFFFu;
@@ -37,6 +37,13 @@
 
 #define MODE_8_BIT		1
 #define MODE_10_BIT		0
+#define MODE_11_BIT		2
+#define MODE_12_BIT		3
+
+// ADC clock profiles (conversion times are for a 20 MHz clock)
+#define ADC_PROFILE_ACCURATE	0	// prescaler 128: 156 kHz ADC clock, 83 us per conversion
+#define ADC_PROFILE_BALANCED	1	// prescaler 64: 313 kHz ADC clock, 42 us per conversion
+#define ADC_PROFILE_FAST		2	// prescaler 32: 625 kHz ADC clock, 21 us per conversion
 
 // ADC Channels
 
@@ -55,6 +62,25 @@
 
 #endif
 
+// An entry in the list of channels sampled by OrangutanAnalog::startScan()
+// (or analog_scan_start()).
+typedef struct AnalogScanEntry
+{
+	unsigned char channel;			// ADC channel (0 - 31)
+	unsigned char samples;			// samples averaged into each result (1 - 64)
+	volatile unsigned int result;	// the most recent average
+	volatile unsigned char updated;	// set whenever result is updated
+} AnalogScanEntry;
+
+// A sample taken by OrangutanAnalog::startTimedSampling() (or
+// analog_timed_sampling_start()).
+typedef struct AnalogSample
+{
+	unsigned long ticks;			// OrangutanTime tick count when the conversion finished
+	unsigned char channel;			// ADC channel (0 - 31)
+	unsigned int value;				// the conversion result, as from conversionResult()
+} AnalogSample;
+
 #ifdef __cplusplus
 
 class OrangutanAnalog
@@ -64,24 +90,38 @@ class OrangutanAnalog
     // constructor (doesn't do anything)
 	OrangutanAnalog();
 
-	// set the ADC to run in either 8-bit mode (MODE_8_BIT) or 
-	// 10-bit mode (MODE_10_BIT)
-	static inline void setMode(unsigned char mode)
-	{
-		if (mode == MODE_10_BIT)
-			ADMUX &= ~(1 << ADLAR);	// right-adjust result (ADC has result)
-		else
-			ADMUX |= 1 << ADLAR;		// left-adjust result (ADCH has result)	
-	}
+	// set the ADC to run in 8-bit mode (MODE_8_BIT), 10-bit mode
+	// (MODE_10_BIT), or one of the oversampled modes (MODE_11_BIT or
+	// MODE_12_BIT).  In the oversampled modes, each sample taken by read()
+	// and readAverage() is the sum of 4 (11-bit) or 16 (12-bit) 10-bit
+	// conversions, decimated to a result from 0 to 2046 or 0 to 4092.  This
+	// only adds resolution if the input has at least one count of noise,
+	// and each sample takes 4 or 16 times as long.  startConversion() still
+	// does a single conversion, and conversionResult() scales it up to the
+	// range of the current mode.
+	static void setMode(unsigned char mode);
 	
-	// returns 0 if in 10-bit mode, otherwise returns non-zero.  The return
-	// value of this method can be directly compared against the macros
-	// MODE_8_BIT and MODE_10_BIT:
+	// returns the current mode.  The return value of this method can be
+	// directly compared against the macros MODE_8_BIT, MODE_10_BIT,
+	// MODE_11_BIT, and MODE_12_BIT:
 	// For example: if (getMode() == MODE_8_BIT) ...
-	static inline unsigned char getMode()
-	{
-		return (ADMUX >> ADLAR) & 1;
-	}
+	static unsigned char getMode();
+
+	// sets the ADC clock prescaler used by this library and by
+	// PololuQTRSensorsAnalog.  ADC_PROFILE_ACCURATE (the default) keeps the
+	// ADC clock within the range needed for full 10-bit accuracy.
+	// ADC_PROFILE_BALANCED and ADC_PROFILE_FAST make conversions two and
+	// four times faster at the cost of roughly one and two bits of
+	// accuracy, which suits 8-bit mode.  Changing the profile waits for
+	// any conversion in progress and then does one conversion at the new
+	// clock, which is discarded.  Do not call this while a background scan
+	// is running.
+	static void setProfile(unsigned char profile);
+	static unsigned char getProfile();
+
+	// returns the value written to ADCSRA to enable the ADC with the clock
+	// prescaler of the current profile (0x87 for ADC_PROFILE_ACCURATE)
+	static unsigned char getADCSRA();
 
 	// take a single analog reading of the specified channel
 	static unsigned int read(unsigned char channel);
@@ -90,30 +130,29 @@ class OrangutanAnalog
 	static unsigned int readMillivolts(unsigned char channel);
 
 	// take 'sample' readings of the specified channel and return the average
+	// (in the oversampled modes, each of the readings is itself made of 4 or
+	// 16 conversions).  On the SVP, the readings of the auxiliary channels
+	// (TRIMPOT and CHANNEL_A - CHANNEL_D) come from the auxiliary processor
+	// at most once per millisecond, so averaging them takes a millisecond
+	// per sample (see OrangutanSVP::getAnalogMillivolts()).
 	static unsigned int readAverage(unsigned char channel, 
 									  unsigned int samples);
 									  
-	static inline unsigned int readAverageMillivolts(unsigned char channel, unsigned int samples)
-	{
-	#ifdef _ORANGUTAN_SVP
-		if (channel > 31)
-		{
-			// We have not implemented averaging of the adc readings from the auxiliary
-			// processor on the SVP, so we will just return a simple reading.
-			return readMillivolts(channel);
-		}
-	#endif
-		return toMillivolts(readAverage(channel, samples));
-	}
+	static unsigned int readAverageMillivolts(unsigned char channel, unsigned int samples);
 	
 	// returns the position of the trimpot (20 readings averaged together).
 	// For all devices except the Orangutan SVP, the trimpot is on ADC channel 7.
 	// On the Orangutan SVP, the trimpot is on the auxiliary processor, so 
 	// calling this function can have side effects related to enabling SPI
-	// communication (see the SVP user's guide for more info).
+	// communication (see the SVP user's guide for more info), and it returns
+	// a single reading rather than waiting 20 ms for 20 of them.
 	static inline unsigned int readTrimpot()
 	{
+	#ifdef _ORANGUTAN_SVP
+		return read(TRIMPOT);
+	#else
 		return readAverage(TRIMPOT, 20);
+	#endif
 	}
 
 	static inline unsigned int readTrimpotMillivolts()
@@ -152,8 +191,101 @@ class OrangutanAnalog
 	// returns the result of the previous ADC conversion.
 	static unsigned int conversionResult();
 
+	// If enable is non-zero, read(), readMillivolts(), and readAverage()
+	// (and the functions built on them) start each conversion by putting the
+	// AVR in ADC noise reduction sleep, waking up on the ADC
+	// conversion-complete interrupt, instead of setting ADSC and polling
+	// isConverting().  Since the conversion only begins once the CPU has
+	// halted, this keeps the digital noise of the running CPU out of the
+	// readings.
+	// Interrupts are enabled by these functions while this is on, and other
+	// interrupts that can run during the sleep (e.g. pin-change interrupts)
+	// will wake the AVR early, in which case it goes back to sleep.  The
+	// sleep stops the I/O clock, so timers 0, 1, and 2, the UART, and SPI
+	// are stopped while a conversion is in progress: motor and servo PWM,
+	// the buzzer, and serial communication are disturbed.  OrangutanTime
+	// also uses timer2, and would lose the time of every conversion, so
+	// while it is running (once ticks() or ms() has been called), the
+	// conversions are done by setting ADSC as usual, without sleeping.
+	static void setNoiseReduction(unsigned char enable);
+
 	// returns the result of the previous ADC conversion in millivolts.
 	static unsigned int conversionResultMillivolts();
+
+	// The following methods sample a list of channels in the background,
+	// driven by the ADC conversion-complete interrupt.  Each entry's channel
+	// is sampled 'samples' times, after one discarded conversion whenever the
+	// channel changes, and the rounded average is stored in its result field
+	// in the current mode (8-bit or 10-bit).  Its updated field is set at the
+	// same time, so you can clear it and wait for it to be set again.  If
+	// continuous is non-zero, the list is sampled over and over until
+	// stopScan() is called; otherwise the scan stops after one pass.  In the
+	// oversampled modes, each sample is made of 4 or 16 conversions as for
+	// readAverage(), using the mode in effect when startScan() is called.  If
+	// callback is not 0, it is called from the interrupt at the end of every
+	// pass, so it should be short.  The entries must not change while the
+	// scan is running, and the other ADC functions must not be used during
+	// that time.  The SVP's auxiliary channels cannot be scanned.  If any
+	// entry has 0 samples, no scan is started and isScanning() returns 0.
+	// Example usage:
+	// AnalogScanEntry channels[] = { { 6, 10 }, { 7, 20 } };
+	// OrangutanAnalog::startScan(channels, 2);
+	static void startScan(AnalogScanEntry *entries, unsigned char numEntries,
+		unsigned char continuous = 1, void (*callback)(void) = 0);
+	static void stopScan();
+
+	// returns 1 while a background scan is running, otherwise 0
+	static unsigned char isScanning();
+
+	// returns 1 if the background scan has finished a pass through its list
+	// since the last call to this method, otherwise 0
+	static unsigned char scanPassComplete();
+
+#ifndef ARDUINO
+	// The following methods sample a list of channels at evenly spaced
+	// times, using the ADC's auto-trigger to start a conversion on every
+	// timer0 overflow, so the sample period does not depend on what the
+	// main loop is doing.  A sample is kept every 'period' overflows, taking
+	// the channels in turn, and stored in the ring buffer with its channel
+	// and the OrangutanTime tick count at which it was converted.  Timer0 is
+	// started at 2.5 MHz if it is not running (it is also the motor PWM timer
+	// on the ATmega48/168/328, which runs it the same way), so it overflows
+	// every 256 ticks (102.4 us) and samples are period * 256 ticks apart.
+	// The buffer holds bufferSize - 1 samples (bufferSize is 2 - 255); when
+	// it is full, new samples are dropped and counted by timedSamplesLost().
+	// The channel list and buffer must not change while sampling, and the
+	// other ADC functions must not be used during that time.  At the
+	// slowest ADC clock a conversion takes 83 us, so the ADC interrupt must
+	// not be delayed by more than about 15 us or a trigger will be missed,
+	// which shows up as a gap in the tick counts.
+	// Example usage (each channel sampled every 20 * 102.4 us = 2.048 ms):
+	// unsigned char channels[] = { 6, 7 };
+	// AnalogSample samples[32];
+	// OrangutanAnalog::startTimedSampling(channels, 2, 10, samples, 32);
+	static void startTimedSampling(const unsigned char *channels, unsigned char numChannels,
+		unsigned char period, AnalogSample *buffer, unsigned char bufferSize);
+	static void stopTimedSampling();
+
+	// returns 1 while timed sampling is running, otherwise 0
+	static unsigned char isTimedSampling();
+
+	// returns the number of samples waiting in the timed sampling buffer
+	static unsigned char timedSamplesAvailable();
+
+	// removes the oldest sample from the timed sampling buffer and copies it
+	// to *sample.  Returns 1 if there was a sample, otherwise 0.
+	static unsigned char readTimedSample(AnalogSample *sample);
+
+	// returns the number of samples dropped because the buffer was full since
+	// timed sampling was started
+	static unsigned int timedSamplesLost();
+#endif
+
+	// Sets the function called from the ADC conversion-complete interrupt.
+	// This is how background ADC features such as startScan() and the
+	// analog QTR sensor scan share that interrupt; only one of them can use
+	// the ADC at a time.  Most programs will not need to call this.
+	static void setConversionHandler(void (*handler)(void));
 	
 	// sets the value used to calibrate the conversion from ADC reading
 	// to millivolts.  The argument calibration should equal VCC in millivolts,
@@ -161,8 +293,9 @@ class OrangutanAnalog
 	// e.g. setMillivoltCalibration(readVCCMillivolts());
 	static void setMillivoltCalibration(unsigned int calibration);
 
-	// averages ten ADC readings of the fixed internal 1.1V bandgap voltage
-	// and computes VCC from the results.  This function returns VCC in millivolts.
+	// lets the ADC settle on the fixed internal 1.1V bandgap voltage, then
+	// measures it in 12-bit mode as the average of five oversampled readings
+	// and computes VCC from the result.  This function returns VCC in millivolts.
 	// Channel 14 is internal 1.1V BG on ATmega48/168/328, but bit 5 of ADMUX is
 	// not used, so channel 30 is equivalent to channel 14.  Channel 30 is the internal
 	// 1.1V BG on ATmega324/644/1284.
@@ -227,17 +360,10 @@ class OrangutanAnalog
 extern "C" {
 #endif // __cplusplus
 
-static inline void set_analog_mode(unsigned char mode)
-{
-	if (mode == MODE_10_BIT)
-		ADMUX &= ~(1 << ADLAR);	// right-adjust result (ADC has result)
-	else
-		ADMUX |= 1 << ADLAR;		// left-adjust result (ADCH has result)	
-}
-static inline unsigned char get_analog_mode(void)
-{
-	return (ADMUX >> ADLAR) & 1;
-}
+void set_analog_mode(unsigned char mode);
+unsigned char get_analog_mode(void);
+void set_analog_profile(unsigned char profile);
+unsigned char get_analog_profile(void);
 unsigned int analog_read(unsigned char channel);
 unsigned int analog_read_millivolts(unsigned char channel);
 unsigned int analog_read_average(unsigned char channel, unsigned int samples);
@@ -249,6 +375,22 @@ static inline unsigned char analog_is_converting(void)
 }
 unsigned int analog_conversion_result(void);
 unsigned int analog_conversion_result_millivolts(void);
+void set_analog_noise_reduction(unsigned char enable);
+void analog_scan_start(AnalogScanEntry *entries, unsigned char numEntries,
+	unsigned char continuous, void (*callback)(void));
+void analog_scan_stop(void);
+unsigned char analog_scan_is_running(void);
+unsigned char analog_scan_pass_complete(void);
+#ifndef ARDUINO
+void analog_timed_sampling_start(const unsigned char *channels, unsigned char numChannels,
+	unsigned char period, AnalogSample *buffer, unsigned char bufferSize);
+void analog_timed_sampling_stop(void);
+unsigned char analog_timed_sampling_is_running(void);
+unsigned char analog_timed_samples_available(void);
+unsigned char analog_read_timed_sample(AnalogSample *sample);
+unsigned int analog_timed_samples_lost(void);
+#endif
+void set_analog_conversion_handler(void (*handler)(void));
 void set_millivolt_calibration(unsigned int calibration);
 unsigned int read_vcc_millivolts(void);
 unsigned int to_millivolts(unsigned int analog_result);
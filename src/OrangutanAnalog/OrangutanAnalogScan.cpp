@@ -0,0 +1,311 @@
+/*
+  OrangutanAnalogScan.cpp - Background sampling of a list of analog
+	channels.  The ADC conversion-complete interrupt walks through the
+	list, averaging the samples of each channel into a result table, so
+	the main loop never has to wait for a conversion.  This file also
+	provides the noise reduction mode, in which the AVR sleeps through
+	each conversion and is woken up by the same interrupt.
+
+	This file also holds the ADC interrupt itself, which calls whatever
+	handler the background ADC features have installed with
+	OrangutanAnalog::setConversionHandler().  It is in its own file so
+	that the interrupt is only linked into programs that use it.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "OrangutanAnalog.h"
+
+// defined in OrangutanAnalog.cpp
+extern void (*analog_conversion_sleeper)(void);
+
+// The function called from the ADC interrupt, or 0 if there is none.
+static void (* volatile conversion_handler)(void);
+
+// The list being scanned and the position in it.
+static AnalogScanEntry *scan_entries;
+static unsigned char scan_num_entries;
+static unsigned char scan_index;
+
+// The conversions of the current entry that have been added up so far.
+static unsigned long scan_sum;
+static unsigned int scan_count;
+
+// The number of bits added by oversampling (see readAverage()) and the
+// number of conversions per sample, from the mode when the scan started.
+static unsigned char scan_extra_bits;
+static unsigned char scan_conversions_per_sample;
+
+// Non-zero if the next conversion is the first one on a new channel,
+// which is discarded like the first one in readAverage().
+static unsigned char scan_discard;
+
+static unsigned char scan_continuous;
+static void (*scan_callback)(void);
+static volatile unsigned char scan_running;
+static volatile unsigned char scan_pass_complete;
+
+
+ISR(ADC_vect)
+{
+	void (*handler)(void) = conversion_handler;
+	if (handler)
+		handler();
+}
+
+
+extern "C" void set_analog_conversion_handler(void (*handler)(void))
+{
+	OrangutanAnalog::setConversionHandler(handler);
+}
+
+extern "C" void analog_scan_start(AnalogScanEntry *entries, unsigned char numEntries,
+	unsigned char continuous, void (*callback)(void))
+{
+	OrangutanAnalog::startScan(entries, numEntries, continuous, callback);
+}
+
+extern "C" void analog_scan_stop()
+{
+	OrangutanAnalog::stopScan();
+}
+
+extern "C" unsigned char analog_scan_is_running()
+{
+	return OrangutanAnalog::isScanning();
+}
+
+extern "C" unsigned char analog_scan_pass_complete()
+{
+	return OrangutanAnalog::scanPassComplete();
+}
+
+extern "C" void set_analog_noise_reduction(unsigned char enable)
+{
+	OrangutanAnalog::setNoiseReduction(enable);
+}
+
+
+void OrangutanAnalog::setConversionHandler(void (*handler)(void))
+{
+	conversion_handler = handler;
+}
+
+
+// Set by the ADC interrupt when the conversion done by convertAsleep()
+// has finished.
+static volatile unsigned char asleep_conversion_done;
+
+static void asleepConversionDone()
+{
+	asleep_conversion_done = 1;
+}
+
+// Does a conversion in ADC noise reduction mode.  The ADC is left enabled
+// but idle, so that, as the datasheet describes, the conversion is started
+// by entering sleep, once the CPU has been halted.  The conversion-complete
+// interrupt wakes the AVR up; if another interrupt wakes it first, it goes
+// back to sleep, which also starts the conversion if it had not begun.
+// Interrupts are disabled between checking for the end of the conversion
+// and sleeping, so that the wake-up cannot be missed; the instruction
+// after sei() is always executed before any pending interrupt.
+// The sleep stops timer2, so while OrangutanTime is using it (its overflow
+// interrupt is enabled), the conversion is done the usual way instead:
+// OrangutanTime would lose the time of the conversion, and its overflow
+// interrupt could not wake the AVR.
+static void convertAsleep()
+{
+	if (TIMSK2 & (1 << TOIE2))
+	{
+		ADCSRA |= 1 << ADSC;
+		while (OrangutanAnalog::isConverting());
+		return;
+	}
+
+	asleep_conversion_done = 0;
+	conversion_handler = asleepConversionDone;
+	ADCSRA |= 1 << ADIE;	// also clears a stale conversion-complete flag
+	set_sleep_mode(SLEEP_MODE_ADC);
+	while (1)
+	{
+		cli();
+		if (asleep_conversion_done)
+			break;
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+	}
+	sei();
+	ADCSRA &= ~(1 << ADIE);
+	conversion_handler = 0;
+}
+
+
+void OrangutanAnalog::setNoiseReduction(unsigned char enable)
+{
+	analog_conversion_sleeper = enable ? convertAsleep : 0;
+}
+
+
+// Selects the channel of the current entry with AVCC as the reference,
+// keeping the 8-bit/10-bit mode, in a single write to ADMUX (see the
+// note in startConversion()).
+static inline void selectScanChannel()
+{
+	ADMUX = (ADMUX & (1 << ADLAR)) | (1 << 6) | (scan_entries[scan_index].channel & 0x1F);
+}
+
+
+// Adds a conversion result to the current entry and starts the next
+// conversion.  This is called from the ADC interrupt.
+static void scanConversion()
+{
+	AnalogScanEntry *entry = &scan_entries[scan_index];
+	unsigned int value = (ADMUX & (1 << ADLAR)) ? ADCH : ADC;
+
+	if (scan_discard)
+		scan_discard = 0;
+	else
+	{
+		scan_sum += value;
+		if (++scan_count >= entry->samples * scan_conversions_per_sample)
+		{
+			unsigned int divisor = entry->samples << scan_extra_bits;
+			entry->result = (scan_sum + (divisor >> 1)) / divisor;
+			entry->updated = 1;
+			scan_sum = 0;
+			scan_count = 0;
+
+			if (++scan_index >= scan_num_entries)
+			{
+				scan_index = 0;
+				scan_pass_complete = 1;
+				if (scan_callback)
+					scan_callback();
+				if (!scan_continuous)
+				{
+					ADCSRA &= ~(1 << ADIE);
+					scan_running = 0;
+					conversion_handler = 0;
+					return;
+				}
+			}
+
+			if (scan_entries[scan_index].channel != entry->channel)
+			{
+				selectScanChannel();
+				scan_discard = 1;
+			}
+		}
+	}
+
+	ADCSRA |= 1 << ADSC;	// start the next conversion
+}
+
+
+// Starts sampling the given list of channels in the background.  A list
+// with an entry of 0 samples is rejected, since scanConversion() would
+// divide by zero.
+void OrangutanAnalog::startScan(AnalogScanEntry *entries, unsigned char numEntries,
+	unsigned char continuous, void (*callback)(void))
+{
+	unsigned char i;
+
+	stopScan();
+	if (numEntries == 0)
+		return;
+	for (i = 0; i < numEntries; i++)
+	{
+		if (entries[i].samples == 0)
+			return;
+	}
+
+	// wait for any current conversion to finish
+	while (isConverting());
+
+	scan_entries = entries;
+	scan_num_entries = numEntries;
+	scan_index = 0;
+	scan_sum = 0;
+	scan_count = 0;
+	scan_discard = 1;
+	scan_extra_bits = 0;
+	if (getMode() == MODE_11_BIT)
+		scan_extra_bits = 1;
+	else if (getMode() == MODE_12_BIT)
+		scan_extra_bits = 2;
+	scan_conversions_per_sample = 1 << (2 * scan_extra_bits);
+	scan_continuous = continuous;
+	scan_callback = callback;
+	scan_pass_complete = 0;
+	scan_running = 1;
+	setConversionHandler(scanConversion);
+
+	// configure the ADC as startConversion() does, clear any stale
+	// conversion-complete flag, enable the interrupt, and start the first
+	// conversion
+	selectScanChannel();
+	ADCSRA = getADCSRA() | (1 << ADIF) | (1 << ADIE);
+	sei();
+	ADCSRA |= 1 << ADSC;
+}
+
+
+// Stops the background scan after the conversion in progress.  The
+// results already in the list are left as they are.
+void OrangutanAnalog::stopScan()
+{
+	if (conversion_handler != scanConversion)
+		return;
+
+	ADCSRA &= ~(1 << ADIE);
+	while (isConverting());
+	ADCSRA |= 1 << ADIF;	// clear the stale flag
+
+	scan_running = 0;
+	setConversionHandler(0);
+}
+
+
+unsigned char OrangutanAnalog::isScanning()
+{
+	return scan_running;
+}
+
+
+// Returns 1 if the scan has finished a pass through the list since the
+// last call, otherwise 0.
+unsigned char OrangutanAnalog::scanPassComplete()
+{
+	if (!scan_pass_complete)
+		return 0;
+	scan_pass_complete = 0;
+	return 1;
+}
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
@@ -0,0 +1,278 @@
+/*
+  OrangutanAnalogTimed.cpp - Evenly spaced sampling of analog channels.
+	Conversions are started by the ADC's auto-trigger on timer0 overflows
+	instead of by the main loop, so the sample period does not depend on
+	what else the program is doing.  Each sample is stored with its channel
+	and the OrangutanTime tick count in a ring buffer, from which the main
+	loop can take samples for filtering, control, or streaming.
+
+	This code is in its own file so that the ADC interrupt, which is
+	shared with the other background ADC features through
+	OrangutanAnalog::setConversionHandler(), is only linked into programs
+	that use it.  It is not available for Arduino, which uses timer0 for
+	its own timing functions.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#ifndef ARDUINO
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "OrangutanAnalog.h"
+#include "../OrangutanTime/OrangutanTime.h"
+
+extern volatile unsigned long tickCount;
+
+// ADC auto-trigger source select bits (ADTS2:0 in ADCSRB) for timer0 overflow
+#define ADC_TRIGGER_TIMER0_OVERFLOW	0x04
+
+// The channels being sampled, in order, and the next one to be stored.
+static const unsigned char *timed_channels;
+static unsigned char timed_num_channels;
+static unsigned char timed_index;
+
+// A sample is stored every timed_period timer0 overflows; the conversions
+// started by the other overflows are discarded.  timed_period is 0 when
+// sampling is stopped.
+static unsigned char timed_period;
+static unsigned char timed_countdown;
+
+// The number of bits conversion results are shifted by to match the mode
+// (see conversionResult()), from the mode when sampling started.
+static unsigned char timed_extra_bits;
+
+// The ring buffer.  The interrupt only writes timed_head and the main loop
+// only writes timed_tail, and one slot is always left empty so that a
+// full buffer can be told from an empty one.
+static AnalogSample *timed_buffer;
+static unsigned char timed_size;
+static volatile unsigned char timed_head;
+static volatile unsigned char timed_tail;
+
+// The number of samples dropped because the buffer was full.
+static volatile unsigned int timed_lost;
+
+
+extern "C" void analog_timed_sampling_start(const unsigned char *channels, unsigned char numChannels,
+	unsigned char period, AnalogSample *buffer, unsigned char bufferSize)
+{
+	OrangutanAnalog::startTimedSampling(channels, numChannels, period, buffer, bufferSize);
+}
+
+extern "C" void analog_timed_sampling_stop()
+{
+	OrangutanAnalog::stopTimedSampling();
+}
+
+extern "C" unsigned char analog_timed_sampling_is_running()
+{
+	return OrangutanAnalog::isTimedSampling();
+}
+
+extern "C" unsigned char analog_timed_samples_available()
+{
+	return OrangutanAnalog::timedSamplesAvailable();
+}
+
+extern "C" unsigned char analog_read_timed_sample(AnalogSample *sample)
+{
+	return OrangutanAnalog::readTimedSample(sample);
+}
+
+extern "C" unsigned int analog_timed_samples_lost()
+{
+	return OrangutanAnalog::timedSamplesLost();
+}
+
+
+// Stores the result of a conversion started by a timer0 overflow and
+// selects the channel for the next one.  This is called from the ADC
+// interrupt.
+static void timedConversion()
+{
+	if (--timed_countdown == 0)
+	{
+		timed_countdown = timed_period;
+
+		// the following is copied from OrangutanTime::ticks() since this is
+		// faster than calling the ticks() method:
+		unsigned long time = TCNT2 | tickCount;
+		if (TIFR2 & (1 << TOV2))	// if TCNT2 has overflowed since the interrupt started
+			time = TCNT2 | (tickCount + 256);	// see OrangutanTime::ticks()
+
+		unsigned char head = timed_head;
+		unsigned char next = head + 1;
+		if (next >= timed_size)
+			next = 0;
+
+		if (next == timed_tail)
+			timed_lost++;
+		else
+		{
+			AnalogSample *sample = &timed_buffer[head];
+			sample->ticks = time;
+			sample->channel = timed_channels[timed_index];
+			if (ADMUX & (1 << ADLAR))
+				sample->value = ADCH;
+			else
+				sample->value = ADC << timed_extra_bits;
+			timed_head = next;
+		}
+
+		if (++timed_index >= timed_num_channels)
+			timed_index = 0;
+
+		// ADMUX may be changed safely after a conversion and before the
+		// trigger flag is cleared, so the new channel is used starting with
+		// the next conversion.
+		ADMUX = (ADMUX & (1 << ADLAR)) | (1 << 6) | (timed_channels[timed_index] & 0x1F);
+	}
+
+	// The ADC is triggered by the rising edge of the timer0 overflow flag,
+	// and there is no timer0 overflow interrupt to clear it, so clearing it
+	// here arms the trigger for the next overflow.
+	TIFR0 = 1 << TOV0;
+}
+
+
+// Starts sampling the given channels in the background.
+void OrangutanAnalog::startTimedSampling(const unsigned char *channels, unsigned char numChannels,
+	unsigned char period, AnalogSample *buffer, unsigned char bufferSize)
+{
+	// only one background feature can use the ADC at a time
+	stopTimedSampling();
+	stopScan();
+	if (numChannels == 0 || period == 0 || bufferSize < 2)
+		return;
+
+	// This also makes sure timer2 is running and that tickCount is being
+	// updated.
+	OrangutanTime::ticks();
+
+	// If timer0 is stopped, run it the way OrangutanMotors does on the
+	// ATmega48/168/328: fast PWM with TOP = 0xFF at 2.5 MHz, the same rate
+	// as timer2, so that it overflows every 256 ticks.  It is left running
+	// when sampling stops in case the motors are using it by then.
+	if ((TCCR0B & 0x07) == 0)
+	{
+		TCCR0A |= 0x03;
+		TCCR0B = (TCCR0B & 0xF0) | 0x02;
+	}
+
+	// wait for any current conversion to finish
+	while (isConverting());
+
+	timed_channels = channels;
+	timed_num_channels = numChannels;
+	timed_index = 0;
+	timed_period = period;
+	timed_countdown = period;
+	timed_extra_bits = 0;
+	if (getMode() == MODE_11_BIT)
+		timed_extra_bits = 1;
+	else if (getMode() == MODE_12_BIT)
+		timed_extra_bits = 2;
+	timed_buffer = buffer;
+	timed_size = bufferSize;
+	timed_head = 0;
+	timed_tail = 0;
+	timed_lost = 0;
+	setConversionHandler(timedConversion);
+
+	// Select the first channel and the trigger source, then enable
+	// auto-triggering and the interrupt, clearing any stale
+	// conversion-complete flag.  Clearing the timer0 overflow flag last
+	// makes the next overflow start the first conversion.
+	ADMUX = (ADMUX & (1 << ADLAR)) | (1 << 6) | (channels[0] & 0x1F);
+	ADCSRB = (ADCSRB & ~0x07) | ADC_TRIGGER_TIMER0_OVERFLOW;
+	ADCSRA = getADCSRA() | (1 << ADATE) | (1 << ADIF) | (1 << ADIE);
+	sei();
+	TIFR0 = 1 << TOV0;
+}
+
+
+// Stops sampling after the conversion in progress.  Samples already in the
+// buffer can still be read.
+void OrangutanAnalog::stopTimedSampling()
+{
+	if (timed_period == 0)
+		return;
+
+	ADCSRA &= ~((1 << ADATE) | (1 << ADIE));
+	while (isConverting());
+	ADCSRA |= 1 << ADIF;	// clear the stale flag
+	ADCSRB &= ~0x07;		// back to free running, the reset value
+
+	timed_period = 0;
+	setConversionHandler(0);
+}
+
+
+unsigned char OrangutanAnalog::isTimedSampling()
+{
+	return timed_period != 0;
+}
+
+
+// returns the number of samples waiting in the buffer
+unsigned char OrangutanAnalog::timedSamplesAvailable()
+{
+	int available = timed_head - timed_tail;
+	if (available < 0)
+		available += timed_size;
+	return available;
+}
+
+
+// Copies the oldest sample in the buffer to *sample and removes it from
+// the buffer.  Returns 1 if there was a sample, otherwise 0.
+unsigned char OrangutanAnalog::readTimedSample(AnalogSample *sample)
+{
+	unsigned char tail = timed_tail;
+	if (tail == timed_head)
+		return 0;
+
+	*sample = timed_buffer[tail];
+	if (++tail >= timed_size)
+		tail = 0;
+	timed_tail = tail;
+	return 1;
+}
+
+
+// returns the number of samples dropped because the buffer was full since
+// startTimedSampling() was called
+unsigned int OrangutanAnalog::timedSamplesLost()
+{
+	unsigned char sreg = SREG;
+	cli();
+	unsigned int lost = timed_lost;
+	SREG = sreg;
+	return lost;
+}
+
+#endif // ARDUINO
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
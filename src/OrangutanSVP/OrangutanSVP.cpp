@@ -22,6 +22,7 @@
  * to be responsible for all resulting costs and damages.
  */
 
+#include <avr/io.h>
 #include "../OrangutanResources/include/OrangutanModel.h"
 #include "../OrangutanSPIMaster/OrangutanSPIMaster.h"
 #include "../OrangutanTime/OrangutanTime.h"
@@ -75,6 +76,11 @@ extern "C" unsigned char svp_check_error_cd()
 	return OrangutanSVP::checkErrorCD();
 }
 
+extern "C" void svp_get_analog_millivolts(SVPAnalogReadings *readings, unsigned int samples)
+{
+	OrangutanSVP::getAnalogMillivolts(readings, samples);
+}
+
 
 typedef union SVPVariables
 {
@@ -89,6 +95,11 @@ typedef union SVPVariables
     	unsigned int trimpot;
     	unsigned int battery;
 	};
+	struct
+	{
+		unsigned char statusByte;
+		unsigned int millivolts[6];	// channelA through battery, in the order above
+	};
 } SVPVariables;
 
 typedef union SVPEncoders
@@ -123,6 +134,9 @@ static SVPVariables svp_variables;
 
 static SVPEncoders encoders;
 
+// The value of ms() from the last time svp_variables was updated.
+static unsigned long svp_variables_last_update_ms = 0xFFFFFFFF;
+
 /* LOW-LEVEL FUNCTIONS FOR DOING SPI COMMUNICATION ****************************/
 // All the delays in these functions were chosen by doing an analysis of the
 // auxiliary processor's assembly code for handling SPI communication.
@@ -183,6 +197,85 @@ unsigned char OrangutanSVP::serialSendIfReady(char byte)
 	return OrangutanSPIMaster::transmitAndDelay(byte & 0x7F, 5);
 }
 
+/* BURST TRANSFERS FOR THE VIRTUAL COM PORT ***********************************/
+// The auxiliary processor's protocol has no command that carries more than
+// one byte to send, and it answers a read with at most 8 bytes, so a burst
+// is still a sequence of the commands above.  What the burst functions
+// save is the time between transfers: instead of doing the post delay and
+// then the work for the next transfer (fetching the byte, looping, calling
+// the functions above), they do the work first and then wait only for what
+// is left of the delay, measured on timer2, which OrangutanTime runs at
+// 2.5 MHz.
+
+// The value of TCNT2 when the last transfer finished.
+static unsigned char svp_transfer_end;
+
+static inline unsigned char svp_transfer(unsigned char data)
+{
+	unsigned char result = OrangutanSPIMaster::transmit(data);
+	svp_transfer_end = TCNT2;
+	return result;
+}
+
+// Waits until at least the given number of microseconds have passed since
+// the last transfer finished.  Timer2 ticks every 0.4 us, and TCNT2 may have
+// been read late in a tick, so one extra tick is waited.
+static inline void svp_wait(unsigned char us)
+{
+	unsigned char ticks = (us * 5 + 1) / 2 + 1;
+	while ((unsigned char)(TCNT2 - svp_transfer_end) < ticks);
+}
+
+unsigned char OrangutanSVP::serialSend(const char *buffer, unsigned char size)
+{
+	unsigned char sent;
+
+	if (size == 0)
+		return 0;
+
+	OrangutanTime::ticks();	// make sure timer2 is running
+
+	for (sent = 0; sent < size; sent++)
+	{
+		char byte = buffer[sent];
+		unsigned char command = byte & 0x80 ? 0x85 : 0x84;
+
+		if (sent != 0)
+			svp_wait(5);
+		svp_transfer(command);
+		svp_wait(5);
+		if (!svp_transfer(byte & 0x7F))
+			break;	// the auxiliary processor's buffer is full
+	}
+
+	svp_wait(5);
+	return sent;
+}
+
+unsigned char OrangutanSVP::serialRead(char *buffer)
+{
+	unsigned char count, i;
+
+	OrangutanTime::ticks();	// make sure timer2 is running
+
+	svp_transfer(0x83);
+	svp_wait(7);
+	count = svp_transfer(0xFF);
+
+	// All of the bytes must be read or they are lost, but never store more
+	// than the caller has room for.
+	for (i = 0; i < count; i++)
+	{
+		svp_wait(4);
+		unsigned char byte = svp_transfer(0xFF);
+		if (i < SVP_SERIAL_READ_SIZE)
+			buffer[i] = byte;
+	}
+
+	svp_wait(4);
+	return count < SVP_SERIAL_READ_SIZE ? count : SVP_SERIAL_READ_SIZE;
+}
+
 void OrangutanSVP::setMode(unsigned char mode)
 {
 	// When the auxiliary processor starts up, it is in SVP_MODE_RX.
@@ -203,9 +296,6 @@ void OrangutanSVP::setMode(unsigned char mode)
 
 static void updateVariablesIfNeeded()
 {
-    // The value of ms() from the last time the svp_variables was updated.
-	static unsigned long svp_variables_last_update_ms = 0xFFFFFFFF;
-	
 	if (OrangutanTime::ms() != svp_variables_last_update_ms)
 	{
 		updateVariables();
@@ -260,6 +350,38 @@ unsigned int OrangutanSVP::getChannelDMillivolts()
 	return svp_variables.channelD;
 }
 
+void OrangutanSVP::getAnalogMillivolts(SVPAnalogReadings *readings, unsigned int samples)
+{
+	unsigned long sum[6] = { 0, 0, 0, 0, 0, 0 };
+	unsigned int sample;
+	unsigned char i;
+
+	if (samples == 0)
+		samples = 1;
+
+	for (sample = 0; sample < samples; sample++)
+	{
+		// The first sample can use the variables already fetched this
+		// millisecond; each of the others waits for a new transfer.
+		if (sample != 0)
+			while (OrangutanTime::ms() == svp_variables_last_update_ms);
+		updateVariablesIfNeeded();
+
+		for (i = 0; i < 6; i++)
+			sum[i] += svp_variables.millivolts[i];
+	}
+
+	for (i = 0; i < 6; i++)
+		sum[i] = (sum[i] + (samples >> 1)) / samples;	// rounded average
+
+	readings->channelA = sum[0];
+	readings->channelB = sum[1];
+	readings->channelC = sum[2];
+	readings->channelD = sum[3];
+	readings->trimpot = sum[4];
+	readings->battery = sum[5];
+}
+
 SVPStatus OrangutanSVP::getStatus()
 {
 	updateVariablesIfNeeded();
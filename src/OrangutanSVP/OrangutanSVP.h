@@ -35,6 +35,10 @@
 
 #define SVP_SLAVE_SELECT_ON   1
 
+// The most bytes the auxiliary processor sends in answer to one read of
+// the virtual COM port, and so the room serialRead() needs.
+#define SVP_SERIAL_READ_SIZE  8
+
 typedef	union SVPStatus
 {
 	unsigned char status;
@@ -49,6 +53,18 @@ typedef	union SVPStatus
 	};
 } SVPStatus;
 
+// The readings of all the auxiliary processor's analog inputs, in millivolts,
+// as returned by OrangutanSVP::getAnalogMillivolts().
+typedef struct SVPAnalogReadings
+{
+	unsigned int channelA;
+	unsigned int channelB;
+	unsigned int channelC;
+	unsigned int channelD;
+	unsigned int trimpot;
+	unsigned int battery;
+} SVPAnalogReadings;
+
 #ifdef __cplusplus
 
 // C++ Function Declarations
@@ -74,11 +90,28 @@ class OrangutanSVP
 	static unsigned char checkErrorAB();
 	static unsigned char checkErrorCD();
 
+	// Analog Functions
+	// Stores the readings of all the auxiliary processor's analog inputs in
+	// *readings, averaged over the given number of samples.  The readings
+	// all come in one transfer, which is done at most once per millisecond
+	// and shared with the get*Millivolts() functions below, so a single
+	// sample costs at most one transfer and each additional sample waits
+	// for the next millisecond's transfer.
+	static void getAnalogMillivolts(SVPAnalogReadings *readings, unsigned int samples = 1);
+
 	// Undocumented functions that are used by other parts of the library that
 	// the typical user does not need to know about:
 	static unsigned char serialSendIfReady(char data);
 	static unsigned char getNextByte();
 	static unsigned char serialReadStart();
+
+	// Burst versions of the above for the virtual COM port: serialSend()
+	// sends bytes until the auxiliary processor stops accepting them and
+	// returns the number sent, and serialRead() reads all the bytes the
+	// auxiliary processor has (at most SVP_SERIAL_READ_SIZE) into buffer
+	// and returns the number read.
+	static unsigned char serialSend(const char *buffer, unsigned char size);
+	static unsigned char serialRead(char *buffer);
 	static unsigned int getBatteryMillivolts();
 	static unsigned int getTrimpotMillivolts();
 	static unsigned int getChannelAMillivolts();
@@ -112,6 +145,9 @@ int svp_get_counts_and_reset_cd(void);
 unsigned char svp_check_error_ab(void);
 unsigned char svp_check_error_cd(void);
 
+// Analog Functions
+void svp_get_analog_millivolts(SVPAnalogReadings *readings, unsigned int samples);
+
 #ifdef __cplusplus
 }
 #endif
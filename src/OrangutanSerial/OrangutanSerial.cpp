@@ -34,6 +34,8 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 
+extern volatile unsigned long tickCount;
+
 
 extern "C" void serial_check()
 {
@@ -61,17 +63,17 @@ extern "C" void serial_set_baud_rate(unsigned char port, unsigned long baud)
 	OrangutanSerial::setBaudRate(port, baud);
 }
 
-extern "C" void serial_receive(unsigned char port, char *buffer, unsigned char size)
+extern "C" void serial_receive(unsigned char port, char *buffer, SerialIndex size)
 {
 	OrangutanSerial::receive(port, buffer, size);
 }
 
-extern "C" char serial_receive_blocking(unsigned char port, char *buffer, unsigned char size, unsigned int timeout_ms)
+extern "C" char serial_receive_blocking(unsigned char port, char *buffer, SerialIndex size, unsigned int timeout_ms)
 {
 	return OrangutanSerial::receiveBlocking(port, buffer, size, timeout_ms);
 }
 
-extern "C" void serial_receive_ring(unsigned char port, char *buffer, unsigned char size)
+extern "C" void serial_receive_ring(unsigned char port, char *buffer, SerialIndex size)
 {
 	OrangutanSerial::receiveRing(port, buffer, size);
 }
@@ -81,7 +83,7 @@ extern "C" void serial_cancel_receive(unsigned char port)
 	OrangutanSerial::cancelReceive(port);
 }
 
-extern "C" unsigned char serial_get_received_bytes(unsigned char port)
+extern "C" SerialIndex serial_get_received_bytes(unsigned char port)
 {
 	return OrangutanSerial::getReceivedBytes(port);
 }
@@ -91,17 +93,17 @@ extern "C" char serial_receive_buffer_full(unsigned char port)
 	return OrangutanSerial::receiveBufferFull(port);
 }
 
-extern "C" void serial_send(unsigned char port, char *buffer, unsigned char size)
+extern "C" void serial_send(unsigned char port, char *buffer, SerialIndex size)
 {
 	OrangutanSerial::send(port, buffer, size);
 }
 
-extern "C" void serial_send_blocking(unsigned char port, char *buffer, unsigned char size)
+extern "C" void serial_send_blocking(unsigned char port, char *buffer, SerialIndex size)
 {
 	OrangutanSerial::sendBlocking(port, buffer, size);
 }
 
-extern "C" unsigned char serial_get_sent_bytes(unsigned char port)
+extern "C" SerialIndex serial_get_sent_bytes(unsigned char port)
 {
 	return OrangutanSerial::getSentBytes(port);
 }
@@ -111,6 +113,41 @@ extern "C" char serial_send_buffer_empty(unsigned char port)
 	return OrangutanSerial::sendBufferEmpty(port);
 }
 
+extern "C" void serial_send_segments(unsigned char port, const SerialSegment *segments, unsigned char count)
+{
+	OrangutanSerial::sendSegments(port, segments, count);
+}
+
+extern "C" void serial_send_segments_blocking(unsigned char port, const SerialSegment *segments, unsigned char count)
+{
+	OrangutanSerial::sendSegmentsBlocking(port, segments, count);
+}
+
+extern "C" void serial_set_send_queue(unsigned char port, char *buffer, SerialIndex size)
+{
+	OrangutanSerial::setSendQueue(port, buffer, size);
+}
+
+extern "C" char serial_queue_send(unsigned char port, const char *buffer, SerialIndex size)
+{
+	return OrangutanSerial::queueSend(port, buffer, size);
+}
+
+extern "C" SerialIndex serial_get_send_queue_space(unsigned char port)
+{
+	return OrangutanSerial::getSendQueueSpace(port);
+}
+
+extern "C" char serial_send_queue_empty(unsigned char port)
+{
+	return OrangutanSerial::sendQueueEmpty(port);
+}
+
+extern "C" void serial_set_receive_timestamps(unsigned char port, unsigned long *times)
+{
+	OrangutanSerial::setReceiveTimestamps(port, times);
+}
+
 #else
 
 /** SINGLE-PORT C FUNCTIONS ***************************************************/
@@ -133,17 +170,17 @@ extern "C" void serial_set_baud_rate(unsigned long baud)
 	OrangutanSerial::setBaudRate(baud);
 }
 
-extern "C" void serial_receive(char *buffer, unsigned char size)
+extern "C" void serial_receive(char *buffer, SerialIndex size)
 {
 	OrangutanSerial::receive(buffer, size);
 }
 
-extern "C" char serial_receive_blocking(char *buffer, unsigned char size, unsigned int timeout_ms)
+extern "C" char serial_receive_blocking(char *buffer, SerialIndex size, unsigned int timeout_ms)
 {
 	return OrangutanSerial::receiveBlocking(buffer, size, timeout_ms);
 }
 
-extern "C" void serial_receive_ring(char *buffer, unsigned char size)
+extern "C" void serial_receive_ring(char *buffer, SerialIndex size)
 {
 	OrangutanSerial::receiveRing(buffer, size);
 }
@@ -153,7 +190,7 @@ extern "C" void serial_cancel_receive()
 	OrangutanSerial::cancelReceive();
 }
 
-extern "C" unsigned char serial_get_received_bytes()
+extern "C" SerialIndex serial_get_received_bytes()
 {
 	return OrangutanSerial::getReceivedBytes();
 }
@@ -163,17 +200,17 @@ extern "C" char serial_receive_buffer_full()
 	return OrangutanSerial::receiveBufferFull();
 }
 
-extern "C" void serial_send(char *buffer, unsigned char size)
+extern "C" void serial_send(char *buffer, SerialIndex size)
 {
 	OrangutanSerial::send(buffer, size);
 }
 
-extern "C" void serial_send_blocking(char *buffer, unsigned char size)
+extern "C" void serial_send_blocking(char *buffer, SerialIndex size)
 {
 	OrangutanSerial::sendBlocking(buffer, size);
 }
 
-extern "C" unsigned char serial_get_sent_bytes()
+extern "C" SerialIndex serial_get_sent_bytes()
 {
 	return OrangutanSerial::getSentBytes();
 }
@@ -183,6 +220,41 @@ extern "C" char serial_send_buffer_empty()
 	return OrangutanSerial::sendBufferEmpty();
 }
 
+extern "C" void serial_send_segments(const SerialSegment *segments, unsigned char count)
+{
+	OrangutanSerial::sendSegments(segments, count);
+}
+
+extern "C" void serial_send_segments_blocking(const SerialSegment *segments, unsigned char count)
+{
+	OrangutanSerial::sendSegmentsBlocking(segments, count);
+}
+
+extern "C" void serial_set_send_queue(char *buffer, SerialIndex size)
+{
+	OrangutanSerial::setSendQueue(buffer, size);
+}
+
+extern "C" char serial_queue_send(const char *buffer, SerialIndex size)
+{
+	return OrangutanSerial::queueSend(buffer, size);
+}
+
+extern "C" SerialIndex serial_get_send_queue_space()
+{
+	return OrangutanSerial::getSendQueueSpace();
+}
+
+extern "C" char serial_send_queue_empty()
+{
+	return OrangutanSerial::sendQueueEmpty();
+}
+
+extern "C" void serial_set_receive_timestamps(unsigned long *times)
+{
+	OrangutanSerial::setReceiveTimestamps(times);
+}
+
 #endif
 
 
@@ -205,17 +277,17 @@ void OrangutanSerial::setMode(unsigned char mode)
 	setMode(0, mode);
 }
 
-void OrangutanSerial::receive(char *buffer, unsigned char size)
+void OrangutanSerial::receive(char *buffer, SerialIndex size)
 {
 	receive(0, buffer, size);
 }
 
-char OrangutanSerial::receiveBlocking(char *buffer, unsigned char size, unsigned int timeout_ms)
+char OrangutanSerial::receiveBlocking(char *buffer, SerialIndex size, unsigned int timeout_ms)
 {
 	return receiveBlocking(0, buffer, size, timeout_ms);
 }
 
-void OrangutanSerial::receiveRing(char *buffer, unsigned char size)
+void OrangutanSerial::receiveRing(char *buffer, SerialIndex size)
 {
 	receiveRing(0, buffer, size);
 }
@@ -225,25 +297,50 @@ void OrangutanSerial::cancelReceive()
 	cancelReceive(0);
 }
 
-void OrangutanSerial::send(char *buffer, unsigned char size)
+void OrangutanSerial::send(char *buffer, SerialIndex size)
 {
 	send(0, buffer, size);
 }
 
-void OrangutanSerial::sendBlocking(char *message, unsigned char size)
+void OrangutanSerial::sendBlocking(char *message, SerialIndex size)
 {
 	sendBlocking(0, message, size);
 }
+
+void OrangutanSerial::sendSegments(const SerialSegment *segments, unsigned char count)
+{
+	sendSegments(0, segments, count);
+}
+
+void OrangutanSerial::sendSegmentsBlocking(const SerialSegment *segments, unsigned char count)
+{
+	sendSegmentsBlocking(0, segments, count);
+}
+
+void OrangutanSerial::setSendQueue(char *buffer, SerialIndex size)
+{
+	setSendQueue(0, buffer, size);
+}
+
+char OrangutanSerial::queueSend(const char *buffer, SerialIndex size)
+{
+	return queueSend(0, buffer, size);
+}
+
+void OrangutanSerial::setReceiveTimestamps(unsigned long *times)
+{
+	setReceiveTimestamps(0, times);
+}
 #endif
 
 /** VARIABLES *****************************************************************/
 
 SerialPortData OrangutanSerial::ports[_SERIAL_PORTS] =
 {
-	{mode:SERIAL_AUTOMATIC, sentBytes:0, receivedBytes:0, sendSize:0, receiveSize:0, receiveRingOn:0, sendBuffer:0, receiveBuffer:0},
+	{mode:SERIAL_AUTOMATIC, sentBytes:0, receivedBytes:0, sendSize:0, receiveSize:0, receiveRingOn:0, sendBuffer:0, receiveBuffer:0, sendQueue:0, sendQueueSize:0, sendQueueHead:0, sendQueueTail:0, sendSegment:0, sendSegmentsLeft:0, receiveHook:0, receiveTimes:0},
 #if _SERIAL_PORTS > 1
-	{mode:SERIAL_AUTOMATIC, sentBytes:0, receivedBytes:0, sendSize:0, receiveSize:0, receiveRingOn:0, sendBuffer:0, receiveBuffer:0},
-	{mode:SERIAL_CHECK,     sentBytes:0, receivedBytes:0, sendSize:0, receiveSize:0, receiveRingOn:0, sendBuffer:0, receiveBuffer:0},
+	{mode:SERIAL_AUTOMATIC, sentBytes:0, receivedBytes:0, sendSize:0, receiveSize:0, receiveRingOn:0, sendBuffer:0, receiveBuffer:0, sendQueue:0, sendQueueSize:0, sendQueueHead:0, sendQueueTail:0, sendSegment:0, sendSegmentsLeft:0, receiveHook:0, receiveTimes:0},
+	{mode:SERIAL_CHECK,     sentBytes:0, receivedBytes:0, sendSize:0, receiveSize:0, receiveRingOn:0, sendBuffer:0, receiveBuffer:0, sendQueue:0, sendQueueSize:0, sendQueueHead:0, sendQueueTail:0, sendSegment:0, sendSegmentsLeft:0, receiveHook:0, receiveTimes:0},
 #endif
 };
 
@@ -417,17 +514,17 @@ void OrangutanSerial::check()
 // buffer, and then the AVR must read all of them or else they will be lost.
 // The auxiliary buffer will send at most 8 bytes at a time.  Therefore, we
 // implement this 8-byte buffer so the user can receive bytes at whatever pace
-// he wants.
+// he wants.  When the receive buffer has room for a whole chunk,
+// serial_rx_check reads straight into it instead.
 namespace OrangutanSVPRXFIFO
 {
 	// The number of bytes received that are in the buffer.
 	static unsigned char byte_count;
 
-	// Holds the bytes received.  The bytes are stored backwards, starting
-	// at buffer[byte_count] for the first byte down to buffer[0] for the last.
-	// This lets us implement getNextByte without having to shift the whole
-	// buffer by one.
-	static unsigned char buffer[8];
+	// Holds the bytes received.  The next byte to be taken is
+	// buffer[next_index].
+	static char buffer[SVP_SERIAL_READ_SIZE];
+	static unsigned char next_index;
 
 	// Returns the number of bytes in the buffer to be received.
 	static unsigned char getReceivedBytes()
@@ -436,11 +533,8 @@ namespace OrangutanSVPRXFIFO
 		{
 			// The buffer is empty, so we can ask the auxiliary processor
 			// for more data.
-			byte_count = OrangutanSVP::serialReadStart();
-			for (unsigned char i=0; i < byte_count; i++)
-			{
-				buffer[byte_count-1-i] = OrangutanSVP::getNextByte();
-			}
+			byte_count = OrangutanSVP::serialRead(buffer);
+			next_index = 0;
 		}
 		return byte_count;
 	}
@@ -449,11 +543,26 @@ namespace OrangutanSVPRXFIFO
 	static unsigned char getNextByte()
 	{
 		byte_count--;
-		return buffer[byte_count];
+		return buffer[next_index++];
 	}
 }
 #endif
 
+// Returns the tick count for a byte that was just received, for
+// setReceiveTimestamps().  The following is copied from
+// OrangutanTime::ticks() since this is faster than calling the ticks()
+// method.
+static inline unsigned long receive_time()
+{
+	unsigned char sreg = SREG;
+	cli();
+	unsigned long time = TCNT2 | tickCount;
+	if (TIFR2 & (1 << TOV2))	// if TCNT2 has overflowed since interrupts were disabled
+		time = TCNT2 | (tickCount + 256);	// see OrangutanTime::ticks()
+	SREG = sreg;
+	return time;
+}
+
 // This is called in check() to take care of receiving bytes.
 // It is only called with a constant port argument, so we don't need
 // to worry about overhead form functions like ucsrb(port), or
@@ -468,9 +577,16 @@ inline void OrangutanSerial::serial_rx_check(unsigned char port)
 		// Disable the RX interrupt so it doesn't interrupt this function.
 		*ucsrb(port) &= ~(1<<RXCIE);
 
-		if(ports[port].receiveBuffer && ports[port].receivedBytes < ports[port].receiveSize && *ucsra(port) & (1<<RXC)) // A byte has been received
+		if((ports[port].receiveHook || (ports[port].receiveBuffer && ports[port].receivedBytes < ports[port].receiveSize)) && *ucsra(port) & (1<<RXC)) // A byte has been received
 		{
-			serial_rx_handle_byte(port, *udr(port));
+			if(ports[port].receiveHook)
+			{
+				ports[port].receiveHook(port, *udr(port));
+			}
+			else
+			{
+				serial_rx_handle_byte(port, *udr(port));
+			}
 		}
 
 		// Re-enable the RX interrupt if desired.
@@ -482,12 +598,55 @@ inline void OrangutanSerial::serial_rx_check(unsigned char port)
     #ifdef USB_COMM
 	else if (port==USB_COMM)
 	{
+		if (ports[USB_COMM].receiveHook)
+		{
+			// Hand every byte received to the hook (e.g. the frame decoder).
+			while(BYTES_RECEIVED)
+			{
+				ports[USB_COMM].receiveHook(USB_COMM, NEXT_BYTE);
+			}
+			return;
+		}
+
+		#ifdef _ORANGUTAN_SVP
+		// While there is room for a whole chunk from the auxiliary processor,
+		// read it straight into the receive buffer.
+		while(ports[USB_COMM].receiveBuffer && OrangutanSVPRXFIFO::byte_count == 0 &&
+			ports[USB_COMM].receiveSize - ports[USB_COMM].receivedBytes >= SVP_SERIAL_READ_SIZE)
+		{
+			SerialIndex start = ports[USB_COMM].receivedBytes;
+			unsigned char count = OrangutanSVP::serialRead(ports[USB_COMM].receiveBuffer + start);
+			if (count == 0)
+			{
+				return; // nothing more has arrived
+			}
+
+			if (ports[USB_COMM].receiveTimes)
+			{
+				unsigned long time = receive_time();
+				for (unsigned char i = 0; i < count; i++)
+				{
+					ports[USB_COMM].receiveTimes[start + i] = time;
+				}
+			}
+			ports[USB_COMM].receivedBytes = start + count;
+
+			if(ports[USB_COMM].receivedBytes == ports[USB_COMM].receiveSize && ports[USB_COMM].receiveRingOn)
+			{
+				ports[USB_COMM].receivedBytes = 0; // reset the ring
+				return;
+			}
+		}
+		#endif
+
 		// While we are trying to receive bytes, and a byte has been received...
 		while(ports[USB_COMM].receiveBuffer && ports[USB_COMM].receivedBytes < ports[USB_COMM].receiveSize && BYTES_RECEIVED)
 		{
 			// We don't call serial_rx_handle_byte here, because that function resets receivedBytes
 			// during ring reception mode, which could cause an infinite loop here.
 
+			if (ports[USB_COMM].receiveTimes)
+				ports[USB_COMM].receiveTimes[ports[USB_COMM].receivedBytes] = receive_time();
 			ports[USB_COMM].receiveBuffer[ports[USB_COMM].receivedBytes] = NEXT_BYTE;
 			ports[USB_COMM].receivedBytes++; // the byte has been received
 
@@ -508,10 +667,17 @@ inline void OrangutanSerial::serial_rx_check(unsigned char port)
 // the ISR (interrupt service routine).  In both cases, it is called with a 
 // constant port argument (or from an inline function with a constant port
 // argument) so we needn't worry about overhead from expressions like ports[port].
+// It does not call the receiveHook: that would make the ISR call a
+// function, and then it would have to save every call-clobbered register
+// for every byte received.
 inline void OrangutanSerial::serial_rx_handle_byte(unsigned char port, unsigned char byte_received)
 {
 	if(ports[port].receiveBuffer && ports[port].receivedBytes < ports[port].receiveSize)
 	{
+		if(ports[port].receiveTimes)
+		{
+			ports[port].receiveTimes[ports[port].receivedBytes] = receive_time();
+		}
 		ports[port].receiveBuffer[ports[port].receivedBytes] = byte_received;
 		ports[port].receivedBytes++; // the byte has been received
 	}
@@ -521,7 +687,14 @@ inline void OrangutanSerial::serial_rx_handle_byte(unsigned char port, unsigned
 	}
 }
 
-inline void OrangutanSerial::receive_inline(unsigned char port, char * buffer, unsigned char size, unsigned char receiveRingOn)
+// The same for the receive interrupts in OrangutanSerialFraming.cpp, which
+// replace the ones below when receiveFrames() is used.
+void OrangutanSerial::serial_rx_store_byte(unsigned char port, unsigned char byte_received)
+{
+	serial_rx_handle_byte(port, byte_received);
+}
+
+inline void OrangutanSerial::receive_inline(unsigned char port, char * buffer, SerialIndex size, unsigned char receiveRingOn)
 {
 	// Disable the RX interrupt if necessary.
 	if (_PORT_IS_UART)
@@ -529,6 +702,8 @@ inline void OrangutanSerial::receive_inline(unsigned char port, char * buffer, u
 		*ucsrb(port) &= ~(1<<RXCIE);
 	}
 
+	ports[port].receiveHook = 0;
+	ports[port].receiveTimes = 0;
 	ports[port].receiveBuffer = buffer;
 	ports[port].receivedBytes = 0;
 	ports[port].receiveSize = size;
@@ -541,12 +716,12 @@ inline void OrangutanSerial::receive_inline(unsigned char port, char * buffer, u
 	}
 }
 
-_SINGLE_PORT_INLINE void OrangutanSerial::receive(unsigned char port, char *buffer, unsigned char size)
+_SINGLE_PORT_INLINE void OrangutanSerial::receive(unsigned char port, char *buffer, SerialIndex size)
 {
 	receive_inline(port, buffer, size, 0);
 }
 
-_SINGLE_PORT_INLINE char OrangutanSerial::receiveBlocking(unsigned char port, char *buffer, unsigned char size, unsigned int timeout_ms)
+_SINGLE_PORT_INLINE char OrangutanSerial::receiveBlocking(unsigned char port, char *buffer, SerialIndex size, unsigned int timeout_ms)
 {
 	receive(port, buffer, size);
 
@@ -568,7 +743,7 @@ _SINGLE_PORT_INLINE char OrangutanSerial::receiveBlocking(unsigned char port, ch
 	}
 }
 
-_SINGLE_PORT_INLINE void OrangutanSerial::receiveRing(unsigned char port, char *buffer, unsigned char size)
+_SINGLE_PORT_INLINE void OrangutanSerial::receiveRing(unsigned char port, char *buffer, SerialIndex size)
 {
 	receive_inline(port, buffer, size, 1);
 }
@@ -578,22 +753,37 @@ _SINGLE_PORT_INLINE void OrangutanSerial::cancelReceive(unsigned char port)
 	receive(port,0,0);
 }
 
+_SINGLE_PORT_INLINE void OrangutanSerial::setReceiveTimestamps(unsigned char port, unsigned long *times)
+{
+	// This also makes sure timer2 is running and that tickCount is being
+	// updated.
+	OrangutanTime::ticks();
+
+	unsigned char sreg = SREG;
+	cli();
+	ports[port].receiveTimes = times;
+	SREG = sreg;
+}
+
+// These are weak so that OrangutanSerialFraming.cpp can replace them.  That
+// file is only linked into programs that call receiveFrames(), so these
+// stay leaf functions in all other programs.
 #ifdef USART_RX_vect
-ISR(USART_RX_vect)
+ISR(USART_RX_vect, __attribute__((weak)))
 {
 	OrangutanSerial::serial_rx_handle_byte(0, UDR0);
 }
 #endif
 
 #ifdef USART0_RX_vect
-ISR(USART0_RX_vect)
+ISR(USART0_RX_vect, __attribute__((weak)))
 {
 	OrangutanSerial::serial_rx_handle_byte(0, UDR0);
 }
 #endif
 
 #ifdef USART1_RX_vect
-ISR(USART1_RX_vect)
+ISR(USART1_RX_vect, __attribute__((weak)))
 {
 	OrangutanSerial::serial_rx_handle_byte(1, UDR1);
 }
@@ -611,11 +801,34 @@ inline void uart_disable_tx_interrupt(unsigned char port)
 	*ucsrb(port) &= ~(1<<UDRIE0);
 }
 
+// True if there are bytes from send() or queueSend() waiting to be sent.
+inline char OrangutanSerial::send_pending(unsigned char port)
+{
+	return (ports[port].sendBuffer && ports[port].sentBytes < ports[port].sendSize) ||
+		ports[port].sendQueueHead != ports[port].sendQueueTail;
+}
+
+// Makes the next non-empty segment of a sendSegments() message the send
+// buffer.  This is called as soon as the last byte of the current segment
+// has started transmission, so that sendBufferEmpty() stays false until
+// the whole message has been sent.
+inline void OrangutanSerial::next_send_segment(unsigned char port)
+{
+	do
+	{
+		const SerialSegment *segment = ports[port].sendSegment++;
+		ports[port].sendSegmentsLeft--;
+		ports[port].sendBuffer = segment->buffer;
+		ports[port].sentBytes = 0;
+		ports[port].sendSize = segment->size;
+	} while (ports[port].sendSize == 0 && ports[port].sendSegmentsLeft);
+}
+
 // Enable the UDRE-empty interrupt if there is data to be sent and we
 // are requesting interrupts.  Otherwise, disable it.
 inline void OrangutanSerial::uart_update_tx_interrupt(unsigned char port)
 {
-	if(ports[port].sendBuffer && ports[port].sentBytes < ports[port].sendSize && ports[port].mode == SERIAL_AUTOMATIC)
+	if(send_pending(port) && ports[port].mode == SERIAL_AUTOMATIC)
 	{
 		uart_enable_tx_interrupt(port);
 	}
@@ -637,27 +850,93 @@ inline void OrangutanSerial::serial_tx_check(unsigned char port)
 
 		uart_tx_isr(port);
 	}
-	#ifdef USB_COMM
+	#ifdef _ORANGUTAN_SVP
 	else if (port==USB_COMM)
 	{
+		// Hand the auxiliary processor whole runs of bytes, so that it
+		// can take them in bursts.
 		while(1)
 		{
-			if(!ports[USB_COMM].sendBuffer || ports[USB_COMM].sentBytes >= ports[USB_COMM].sendSize)
+			if(ports[USB_COMM].sendBuffer && ports[USB_COMM].sentBytes < ports[USB_COMM].sendSize)
 			{
-				// Return because we have nothing (more) to send.
-				return;
+				SerialIndex left = ports[USB_COMM].sendSize - ports[USB_COMM].sentBytes;
+				unsigned char run = left > 0xFF ? 0xFF : left;
+				unsigned char sent = OrangutanSVP::serialSend(ports[USB_COMM].sendBuffer + ports[USB_COMM].sentBytes, run);
+
+				ports[USB_COMM].sentBytes += sent;
+				if (ports[USB_COMM].sentBytes == ports[USB_COMM].sendSize && ports[USB_COMM].sendSegmentsLeft)
+				{
+					next_send_segment(USB_COMM);
+				}
+
+				if (sent == run)
+				{
+					// Try to send more.
+					continue;
+				}
 			}
-			
-			if (SEND_BYTE_IF_READY(ports[USB_COMM].sendBuffer[ports[USB_COMM].sentBytes]))
+			else if (ports[USB_COMM].sendQueueHead != ports[USB_COMM].sendQueueTail)
 			{
-				// We successfully started sending a byte
-				ports[USB_COMM].sentBytes++;
+				// Send up to the head or to the end of the queue, whichever
+				// comes first.
+				SerialIndex tail = ports[USB_COMM].sendQueueTail;
+				SerialIndex head = ports[USB_COMM].sendQueueHead;
+				SerialIndex left = (head > tail ? head : ports[USB_COMM].sendQueueSize) - tail;
+				unsigned char run = left > 0xFF ? 0xFF : left;
+				unsigned char sent = OrangutanSVP::serialSend(ports[USB_COMM].sendQueue + tail, run);
+
+				tail += sent;
+				if (tail == ports[USB_COMM].sendQueueSize){ tail = 0; }
+				ports[USB_COMM].sendQueueTail = tail;
+
+				if (sent == run)
+				{
+					// Try to send more.
+					continue;
+				}
+			}
 
-				// Try to send another byte.
-				continue;
+			// Return because we have nothing (more) to send or
+			// can not send any more bytes.
+			return;
+		}
+	}
+	#elif defined(USB_COMM)
+	else if (port==USB_COMM)
+	{
+		while(1)
+		{
+			if(ports[USB_COMM].sendBuffer && ports[USB_COMM].sentBytes < ports[USB_COMM].sendSize)
+			{
+				if (SEND_BYTE_IF_READY(ports[USB_COMM].sendBuffer[ports[USB_COMM].sentBytes]))
+				{
+					// We successfully started sending a byte
+					ports[USB_COMM].sentBytes++;
+					if (ports[USB_COMM].sentBytes == ports[USB_COMM].sendSize && ports[USB_COMM].sendSegmentsLeft)
+					{
+						next_send_segment(USB_COMM);
+					}
+
+					// Try to send another byte.
+					continue;
+				}
+			}
+			else if (ports[USB_COMM].sendQueueHead != ports[USB_COMM].sendQueueTail)
+			{
+				SerialIndex tail = ports[USB_COMM].sendQueueTail;
+				if (SEND_BYTE_IF_READY(ports[USB_COMM].sendQueue[tail]))
+				{
+					// We successfully started sending a queued byte
+					if (++tail == ports[USB_COMM].sendQueueSize){ tail = 0; }
+					ports[USB_COMM].sendQueueTail = tail;
+
+					// Try to send another byte.
+					continue;
+				}
 			}
-			
-			// Return because we can not send any more bytes.
+
+			// Return because we have nothing (more) to send or
+			// can not send any more bytes.
 			return;
 		}
 	}
@@ -666,10 +945,25 @@ inline void OrangutanSerial::serial_tx_check(unsigned char port)
 
 inline void OrangutanSerial::uart_tx_isr(unsigned char port)
 {
-	if(ports[port].sendBuffer && ports[port].sentBytes < ports[port].sendSize && *ucsra(port) & (1<<UDRE))
+	if(ports[port].sendBuffer && ports[port].sentBytes < ports[port].sendSize)
+	{
+		if (*ucsra(port) & (1<<UDRE))
+		{
+		    *udr(port) = ports[port].sendBuffer[ports[port].sentBytes];
+			ports[port].sentBytes++; // we started sending a byte
+			if (ports[port].sentBytes == ports[port].sendSize && ports[port].sendSegmentsLeft)
+			{
+				next_send_segment(port);
+			}
+		}
+	}
+	else if(ports[port].sendQueueHead != ports[port].sendQueueTail && *ucsra(port) & (1<<UDRE))
 	{
-	    *udr(port) = ports[port].sendBuffer[ports[port].sentBytes];
-		ports[port].sentBytes++; // we started sending a byte
+		// The send buffer is finished, so send the next byte from the queue.
+		SerialIndex tail = ports[port].sendQueueTail;
+		*udr(port) = ports[port].sendQueue[tail];
+		if (++tail == ports[port].sendQueueSize){ tail = 0; }
+		ports[port].sendQueueTail = tail; // we started sending a byte
 	}
 
 	// If called from an interrupt, this will disable the interrupt so we don't get called again.
@@ -677,8 +971,9 @@ inline void OrangutanSerial::uart_tx_isr(unsigned char port)
 	uart_update_tx_interrupt(port);
 }
 
-_SINGLE_PORT_INLINE void OrangutanSerial::send(unsigned char port, char *buffer, unsigned char size)
+_SINGLE_PORT_INLINE void OrangutanSerial::send(unsigned char port, char *buffer, SerialIndex size)
 {
+	ports[port].sendSegmentsLeft = 0;
 	ports[port].sendBuffer = buffer;
 	ports[port].sentBytes = 0;
 	ports[port].sendSize = size;
@@ -690,7 +985,7 @@ _SINGLE_PORT_INLINE void OrangutanSerial::send(unsigned char port, char *buffer,
 	}
 }
 
-_SINGLE_PORT_INLINE void OrangutanSerial::sendBlocking(unsigned char port, char *buffer, unsigned char size)
+_SINGLE_PORT_INLINE void OrangutanSerial::sendBlocking(unsigned char port, char *buffer, SerialIndex size)
 {
 	send(port, buffer, size);
 
@@ -698,6 +993,86 @@ _SINGLE_PORT_INLINE void OrangutanSerial::sendBlocking(unsigned char port, char
 	while(!sendBufferEmpty(port)){ check(); }
 }
 
+_SINGLE_PORT_INLINE void OrangutanSerial::sendSegments(unsigned char port, const SerialSegment *segments, unsigned char count)
+{
+	// Disable the TX interrupt so it doesn't see a half-loaded segment.
+	if (_PORT_IS_UART)
+	{
+		uart_disable_tx_interrupt(port);
+	}
+
+	ports[port].sendSegment = segments;
+	ports[port].sendSegmentsLeft = count;
+	if (count)
+	{
+		next_send_segment(port);
+	}
+	else
+	{
+		ports[port].sendBuffer = 0;
+		ports[port].sentBytes = 0;
+		ports[port].sendSize = 0;
+	}
+
+	// enable the interrupts, and everything will be started by the ISR
+	if (_PORT_IS_UART)
+	{
+		uart_update_tx_interrupt(port);
+	}
+}
+
+_SINGLE_PORT_INLINE void OrangutanSerial::sendSegmentsBlocking(unsigned char port, const SerialSegment *segments, unsigned char count)
+{
+	sendSegments(port, segments, count);
+
+	// wait for sending before returning
+	while(!sendBufferEmpty(port)){ check(); }
+}
+
+_SINGLE_PORT_INLINE void OrangutanSerial::setSendQueue(unsigned char port, char *buffer, SerialIndex size)
+{
+	// Disable the TX interrupt so it doesn't use the queue while it changes.
+	if (_PORT_IS_UART)
+	{
+		uart_disable_tx_interrupt(port);
+	}
+
+	ports[port].sendQueue = buffer;
+	ports[port].sendQueueSize = buffer ? size : 0;
+	ports[port].sendQueueHead = 0;
+	ports[port].sendQueueTail = 0;
+
+	if (_PORT_IS_UART)
+	{
+		uart_update_tx_interrupt(port);
+	}
+}
+
+_SINGLE_PORT_INLINE char OrangutanSerial::queueSend(unsigned char port, const char *buffer, SerialIndex size)
+{
+	if (size > getSendQueueSpace(port))
+	{
+		return 0; // not enough space
+	}
+
+	// Only this function changes sendQueueHead, and the bytes are stored
+	// before it is updated, so the ISR never sees a partly-queued message.
+	SerialIndex head = ports[port].sendQueueHead;
+	while (size--)
+	{
+		ports[port].sendQueue[head] = *buffer++;
+		if (++head == ports[port].sendQueueSize){ head = 0; }
+	}
+	indexWrite(&ports[port].sendQueueHead, head);
+
+	// enable the interrupts, and everything will be started by the ISR
+	if (_PORT_IS_UART)
+	{
+		uart_update_tx_interrupt(port);
+	}
+	return 1;
+}
+
 #ifdef USART_UDRE_vect
 ISR(USART_UDRE_vect)
 {
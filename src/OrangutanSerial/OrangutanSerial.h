@@ -26,6 +26,7 @@
 
 #include "../OrangutanResources/include/OrangutanModel.h"
 
+#include <avr/io.h>
 #include <avr/interrupt.h>
 
 #if defined(_ORANGUTAN_SVP)
@@ -62,18 +63,51 @@
 #define SERIAL_AUTOMATIC 0
 #define SERIAL_CHECK 1
 
+// Buffer sizes and positions.  On devices with enough RAM for buffers
+// larger than 255 bytes (more than 2 KB, i.e. the ATmega644P and
+// ATmega1284P) they are 16-bit; elsewhere they stay 8-bit, which keeps
+// the interrupts shorter.
+#if defined(RAMEND) && RAMEND > 0x8FF
+ #define _SERIAL_INDEX_16BIT
+ typedef unsigned int SerialIndex;
+#else
+ typedef unsigned char SerialIndex;
+#endif
+
+// Framing modes for receiveFrames()
+#define SERIAL_FRAMING_NONE		0
+#define SERIAL_FRAMING_LINE		1	// each frame ends with '\n'
+#define SERIAL_FRAMING_SLIP		2	// SLIP (RFC 1055): frames end with 0xC0
+#define SERIAL_FRAMING_COBS		3	// COBS: frames end with 0x00
+#define SERIAL_FRAMING_CRC8		0x80	// or'd with one of the above: each frame ends with a CRC-8
+
+// One piece of a message sent with sendSegments() (or serial_send_segments()).
+typedef struct SerialSegment
+{
+	char *buffer;
+	SerialIndex size;
+} SerialSegment;
+
 #ifdef __cplusplus
 
 typedef struct SerialPortData
 {
 	unsigned char mode;	// SERIAL_AUTOMATIC (interrupt-driven) or SERIAL_CHECK
-	volatile unsigned char sentBytes;
-	volatile unsigned char receivedBytes;
-	unsigned char sendSize;
-	unsigned char receiveSize;
+	volatile SerialIndex sentBytes;
+	volatile SerialIndex receivedBytes;
+	volatile SerialIndex sendSize;	// changed by the transmit interrupt for sendSegments()
+	SerialIndex receiveSize;
 	unsigned char receiveRingOn; // boolean
 	char *sendBuffer;
 	char *receiveBuffer;
+	char *sendQueue;	// ring buffer for queueSend(), or 0
+	SerialIndex sendQueueSize;
+	volatile SerialIndex sendQueueHead;	// where the next queued byte goes
+	volatile SerialIndex sendQueueTail;	// the next queued byte to transmit
+	const SerialSegment *sendSegment;	// the next segment for sendSegments()
+	volatile unsigned char sendSegmentsLeft;
+	void (*receiveHook)(unsigned char port, unsigned char byte);	// takes over received bytes, e.g. for receiveFrames()
+	unsigned long *receiveTimes;	// tick counts of the bytes in receiveBuffer, or 0
 } SerialPortData;
 
 class OrangutanSerial
@@ -118,6 +152,15 @@ class OrangutanSerial
 
 	// receiveBufferFull: True when the receive buffer is full.
 
+	// setReceiveTimestamps: Records the OrangutanTime tick count at which
+	// each byte arrives: times[i] is set when receiveBuffer[i] is stored,
+	// so times must have room for as many entries as the receive buffer
+	// has bytes.  This can be used to measure how long a command waited
+	// or to find message boundaries by the idle time between bytes.  Call
+	// it after receive() or receiveRing(), which turn it off; pass 0 to
+	// turn it off.  On the USB_COMM port, the time is when check() found
+	// the byte, not when it arrived over USB.
+
 	// send: Sets up a buffer for background transmit.
 	// Data from this buffer will be transmitted until size bytes have
 	// been sent.  If send() is called before sendBufferEmpty()
@@ -136,20 +179,90 @@ class OrangutanSerial
 
 	// sendBufferEmpty: True when the send buffer is empty.
 
+	// sendSegments: Like send(), but transmits a message made of count
+	// separate pieces (for example a header, a payload and a checksum)
+	// one after the other, without copying them into one buffer first.
+	// The segment list and the data it points to must not change until
+	// sendBufferEmpty() returns true.  While the message is being sent,
+	// getSentBytes() counts the bytes sent from the current segment.
+
+	// sendSegmentsBlocking: Same as sendSegments(), but waits until
+	// transmission of the last byte has started to return.
+
+	// receiveFrames: Sets up background reception of framed messages.
+	// Instead of storing raw bytes, the receive interrupt (or check())
+	// finds the frame boundaries and decodes the frames as they arrive.
+	// framing is SERIAL_FRAMING_LINE, SERIAL_FRAMING_SLIP, or
+	// SERIAL_FRAMING_COBS, optionally or'd with SERIAL_FRAMING_CRC8, in
+	// which case the last byte of each frame must be the CRC-8
+	// (polynomial 0x07) of the rest; it is checked and removed.  Frames
+	// that are longer than the buffer, badly encoded, or fail the CRC are
+	// dropped and counted by getFrameErrors().  Empty frames are ignored.
+	// If callback is not 0, it is called from the interrupt with each
+	// frame, which is in the buffer only until the callback returns.
+	// Otherwise, the buffer is split in two halves, so that one frame can
+	// be received while the main loop handles the previous one with
+	// getFrame() and releaseFrame(); frames that arrive while both halves
+	// are full are dropped.  receive(), receiveRing(), cancelReceive(), and
+	// receiveFrames(SERIAL_FRAMING_NONE, 0, 0, 0) stop frame reception.
+
+	// getFrame: Returns the oldest complete frame and stores its length in
+	// *length, or returns 0 if there is none.  The frame stays valid until
+	// releaseFrame() is called.
+
+	// releaseFrame: Frees the space of the frame returned by getFrame().
+
+	// getFrameErrors: Gets the number of frames dropped since
+	// receiveFrames() was called (up to 255).
+
+	// getFrameTime: Gets the tick count at which the first byte of a frame
+	// arrived: the frame returned by getFrame(), or, when called from the
+	// frame callback, the frame passed to it.
+
+	// setSendQueue: Gives the library a buffer to use as a transmit
+	// queue (FIFO).  Up to size-1 bytes can be waiting in the queue.
+	// Any bytes already in the old queue are discarded.
+
+	// queueSend: Copies size bytes to the end of the transmit queue,
+	// where they will be sent in the background after the bytes queued
+	// before them, so messages can be queued back to back without
+	// waiting for each other.  The caller's buffer can be reused as soon
+	// as this returns.  Returns true if the bytes were queued, or false
+	// (without queueing any of them) if there is not enough space.
+	// Bytes from send() are transmitted ahead of queued bytes, so avoid
+	// calling send() while the queue is in use.
+
+	// getSendQueueSpace: Gets the number of bytes that can be queued.
+
+	// sendQueueEmpty: True when every queued byte has started
+	// transmission.
+
 #if _SERIAL_PORTS == 1
 	static void setBaudRate(unsigned long baud);
 	static void setMode(unsigned char mode);
-	static void receive(char *buffer, unsigned char size);
-	static char receiveBlocking(char *buffer, unsigned char size, unsigned int timeout_ms);
-	static void receiveRing(char *buffer, unsigned char size);
+	static void receive(char *buffer, SerialIndex size);
+	static char receiveBlocking(char *buffer, SerialIndex size, unsigned int timeout_ms);
+	static void receiveRing(char *buffer, SerialIndex size);
 	static void cancelReceive();
-	static void send(char *buffer, unsigned char size);
-	static void sendBlocking(char *buffer, unsigned char size);
-	static inline char sendBufferEmpty() { return ports[0].sentBytes == ports[0].sendSize; }
-	static inline unsigned char getSentBytes() { return ports[0].sentBytes; }
-	static inline unsigned char getReceivedBytes() { return ports[0].receivedBytes; }
+	static void send(char *buffer, SerialIndex size);
+	static void sendBlocking(char *buffer, SerialIndex size);
+	static inline char sendBufferEmpty() { return sendBufferEmpty(0); }
+	static inline SerialIndex getSentBytes() { return indexRead(&ports[0].sentBytes); }
+	static inline SerialIndex getReceivedBytes() { return indexRead(&ports[0].receivedBytes); }
 	static inline char receiveBufferFull() { return getReceivedBytes() == ports[0].receiveSize; }
 	static inline unsigned char getMode() { return ports[0].mode; }
+	static void sendSegments(const SerialSegment *segments, unsigned char count);
+	static void sendSegmentsBlocking(const SerialSegment *segments, unsigned char count);
+	static void setSendQueue(char *buffer, SerialIndex size);
+	static char queueSend(const char *buffer, SerialIndex size);
+	static void receiveFrames(unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length));
+	static char *getFrame(unsigned char *length);
+	static void releaseFrame();
+	static unsigned char getFrameErrors();
+	static unsigned long getFrameTime();
+	static void setReceiveTimestamps(unsigned long *times);
+	static inline SerialIndex getSendQueueSpace() { return getSendQueueSpace(0); }
+	static inline char sendQueueEmpty() { return sendQueueEmpty(0); }
 #endif
 
 #if _SERIAL_PORTS > 1
@@ -159,25 +272,83 @@ class OrangutanSerial
 #endif
 	static _SINGLE_PORT_INLINE void setBaudRate(unsigned char port, unsigned long baud);
 	static _SINGLE_PORT_INLINE void setMode(unsigned char port, unsigned char mode);
-	static _SINGLE_PORT_INLINE void receive(unsigned char port, char *buffer, unsigned char size);
-	static _SINGLE_PORT_INLINE char receiveBlocking(unsigned char port, char *buffer, unsigned char size, unsigned int timeout_ms);
-	static _SINGLE_PORT_INLINE void receiveRing(unsigned char port, char *buffer, unsigned char size);
+	static _SINGLE_PORT_INLINE void receive(unsigned char port, char *buffer, SerialIndex size);
+	static _SINGLE_PORT_INLINE char receiveBlocking(unsigned char port, char *buffer, SerialIndex size, unsigned int timeout_ms);
+	static _SINGLE_PORT_INLINE void receiveRing(unsigned char port, char *buffer, SerialIndex size);
 	static _SINGLE_PORT_INLINE void cancelReceive(unsigned char port);
-	static _SINGLE_PORT_INLINE void send(unsigned char port, char *buffer, unsigned char size);
-	static _SINGLE_PORT_INLINE void sendBlocking(unsigned char port, char *buffer, unsigned char size);
-	static inline char sendBufferEmpty(unsigned char port) { return ports[port].sentBytes == ports[port].sendSize; }
+	static _SINGLE_PORT_INLINE void send(unsigned char port, char *buffer, SerialIndex size);
+	static _SINGLE_PORT_INLINE void sendBlocking(unsigned char port, char *buffer, SerialIndex size);
+	static inline char sendBufferEmpty(unsigned char port)
+	{
+		// The transmit interrupt starts the next segment of a sendSegments()
+		// message by changing sentBytes and sendSize, so they are read
+		// together with sendSegmentsLeft with interrupts disabled.
+		unsigned char sreg = SREG;
+		cli();
+		char empty = ports[port].sentBytes == ports[port].sendSize && ports[port].sendSegmentsLeft == 0;
+		SREG = sreg;
+		return empty;
+	}
 	static inline unsigned char getMode(unsigned char port) { return ports[port].mode; }
-	static inline unsigned char getReceivedBytes(unsigned char port) { return ports[port].receivedBytes; }
+	static inline SerialIndex getReceivedBytes(unsigned char port) { return indexRead(&ports[port].receivedBytes); }
 	static inline char receiveBufferFull(unsigned char port) { return getReceivedBytes(port) == ports[port].receiveSize; }
-	static inline unsigned char getSentBytes(unsigned char port) { return ports[port].sentBytes; }
+	static inline SerialIndex getSentBytes(unsigned char port) { return indexRead(&ports[port].sentBytes); }
+	static _SINGLE_PORT_INLINE void sendSegments(unsigned char port, const SerialSegment *segments, unsigned char count);
+	static _SINGLE_PORT_INLINE void sendSegmentsBlocking(unsigned char port, const SerialSegment *segments, unsigned char count);
+	static _SINGLE_PORT_INLINE void setSendQueue(unsigned char port, char *buffer, SerialIndex size);
+	static _SINGLE_PORT_INLINE char queueSend(unsigned char port, const char *buffer, SerialIndex size);
+	static inline SerialIndex getSendQueueSpace(unsigned char port)
+	{
+		SerialIndex head = ports[port].sendQueueHead, tail = indexRead(&ports[port].sendQueueTail);
+		if (ports[port].sendQueueSize == 0)
+			return 0;
+		return (tail > head ? tail - head : ports[port].sendQueueSize - (head - tail)) - 1;
+	}
+	static inline char sendQueueEmpty(unsigned char port) { return ports[port].sendQueueHead == indexRead(&ports[port].sendQueueTail); }
+	static void receiveFrames(unsigned char port, unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length));
+	static char *getFrame(unsigned char port, unsigned char *length);
+	static void releaseFrame(unsigned char port);
+	static unsigned char getFrameErrors(unsigned char port);
+	static unsigned long getFrameTime(unsigned char port);
+	static _SINGLE_PORT_INLINE void setReceiveTimestamps(unsigned char port, unsigned long *times);
 
   private:
 
 	static SerialPortData ports[_SERIAL_PORTS];
 
+	// Reads or writes an index that an interrupt also uses.  16-bit
+	// indices take two instructions, so interrupts are disabled in
+	// between.  The interrupts themselves access the indices directly.
+	static inline SerialIndex indexRead(volatile SerialIndex *index)
+	{
+	#ifdef _SERIAL_INDEX_16BIT
+		unsigned char sreg = SREG;
+		cli();
+		SerialIndex value = *index;
+		SREG = sreg;
+		return value;
+	#else
+		return *index;
+	#endif
+	}
+
+	static inline void indexWrite(volatile SerialIndex *index, SerialIndex value)
+	{
+	#ifdef _SERIAL_INDEX_16BIT
+		unsigned char sreg = SREG;
+		cli();
+		*index = value;
+		SREG = sreg;
+	#else
+		*index = value;
+	#endif
+	}
+
 	static inline void initUART_inline(unsigned char port);
-	static inline void receive_inline(unsigned char port, char *buffer, unsigned char size, unsigned char ring);
+	static inline void receive_inline(unsigned char port, char *buffer, SerialIndex size, unsigned char ring);
 
+	static inline char send_pending(unsigned char port);
+	static inline void next_send_segment(unsigned char port);
 	static inline void uart_update_tx_interrupt(unsigned char port);
 	static inline void serial_tx_check(unsigned char port);
 	static inline void serial_rx_check(unsigned char port);
@@ -190,6 +361,8 @@ class OrangutanSerial
   public:
 	static inline void uart_tx_isr(unsigned char port);
 	static inline void serial_rx_handle_byte(unsigned char port, unsigned char byte_received);
+	static void serial_rx_store_byte(unsigned char port, unsigned char byte_received);
+	static inline void serial_rx_handle_frame_byte(unsigned char port, unsigned char byte_received);
 };
 
 extern "C" {
@@ -202,30 +375,54 @@ void serial_check(void);
 void serial_set_baud_rate(unsigned char port, unsigned long baud);
 void serial_set_mode(unsigned char port, unsigned char mode);
 unsigned char serial_get_mode(unsigned char port);
-void serial_receive(unsigned char port, char *buffer, unsigned char size);
+void serial_receive(unsigned char port, char *buffer, SerialIndex size);
 void serial_cancel_receive(unsigned char port);
-char serial_receive_blocking(unsigned char port, char *buffer, unsigned char size, unsigned int timeout);
-void serial_receive_ring(unsigned char port, char *buffer, unsigned char size);
-unsigned char serial_get_received_bytes(unsigned char port);
+char serial_receive_blocking(unsigned char port, char *buffer, SerialIndex size, unsigned int timeout);
+void serial_receive_ring(unsigned char port, char *buffer, SerialIndex size);
+SerialIndex serial_get_received_bytes(unsigned char port);
 char serial_receive_buffer_full(unsigned char port);
-void serial_send(unsigned char port, char *buffer, unsigned char size);
-void serial_send_blocking(unsigned char port, char *buffer, unsigned char size);
-unsigned char serial_get_sent_bytes(unsigned char port);
+void serial_send(unsigned char port, char *buffer, SerialIndex size);
+void serial_send_blocking(unsigned char port, char *buffer, SerialIndex size);
+SerialIndex serial_get_sent_bytes(unsigned char port);
 char serial_send_buffer_empty(unsigned char port);
+void serial_send_segments(unsigned char port, const SerialSegment *segments, unsigned char count);
+void serial_send_segments_blocking(unsigned char port, const SerialSegment *segments, unsigned char count);
+void serial_set_send_queue(unsigned char port, char *buffer, SerialIndex size);
+char serial_queue_send(unsigned char port, const char *buffer, SerialIndex size);
+SerialIndex serial_get_send_queue_space(unsigned char port);
+char serial_send_queue_empty(unsigned char port);
+void serial_receive_frames(unsigned char port, unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length));
+char *serial_get_frame(unsigned char port, unsigned char *length);
+void serial_release_frame(unsigned char port);
+unsigned char serial_get_frame_errors(unsigned char port);
+unsigned long serial_get_frame_time(unsigned char port);
+void serial_set_receive_timestamps(unsigned char port, unsigned long *times);
 #else
 void serial_set_baud_rate(unsigned long baud);
 void serial_set_mode(unsigned char mode);
 unsigned char serial_get_mode(void);
-void serial_receive(char *buffer, unsigned char size);
+void serial_receive(char *buffer, SerialIndex size);
 void serial_cancel_receive(void);
-char serial_receive_blocking(char *buffer, unsigned char size, unsigned int timeout);
-void serial_receive_ring(char *buffer, unsigned char size);
-unsigned char serial_get_received_bytes(void);
+char serial_receive_blocking(char *buffer, SerialIndex size, unsigned int timeout);
+void serial_receive_ring(char *buffer, SerialIndex size);
+SerialIndex serial_get_received_bytes(void);
 char serial_receive_buffer_full(void);
-void serial_send(char *buffer, unsigned char size);
-void serial_send_blocking(char *buffer, unsigned char size);
-unsigned char serial_get_sent_bytes(void);
+void serial_send(char *buffer, SerialIndex size);
+void serial_send_blocking(char *buffer, SerialIndex size);
+SerialIndex serial_get_sent_bytes(void);
 char serial_send_buffer_empty(void);
+void serial_send_segments(const SerialSegment *segments, unsigned char count);
+void serial_send_segments_blocking(const SerialSegment *segments, unsigned char count);
+void serial_set_send_queue(char *buffer, SerialIndex size);
+char serial_queue_send(const char *buffer, SerialIndex size);
+SerialIndex serial_get_send_queue_space(void);
+char serial_send_queue_empty(void);
+void serial_receive_frames(unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length));
+char *serial_get_frame(unsigned char *length);
+void serial_release_frame(void);
+unsigned char serial_get_frame_errors(void);
+unsigned long serial_get_frame_time(void);
+void serial_set_receive_timestamps(unsigned long *times);
 #endif
 
 #ifdef __cplusplus
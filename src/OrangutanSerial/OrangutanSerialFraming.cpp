@@ -0,0 +1,430 @@
+/*
+  OrangutanSerialFraming.cpp - Background reception of framed messages.
+	The receive interrupt (or check(), in SERIAL_CHECK mode) passes each
+	byte to a decoder here instead of storing it, so complete frames are
+	found and decoded as they arrive, and the main loop only has to deal
+	with whole messages.
+
+	This code is in its own file so that programs that do not use framing
+	do not pay for the decoders.  It also defines the receive interrupts,
+	which replace the weak ones in OrangutanSerial.cpp: those must not
+	call any function, so that they do not have to save every
+	call-clobbered register for each byte.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "OrangutanSerial.h"
+#include "../OrangutanTime/OrangutanTime.h"
+
+extern volatile unsigned long tickCount;
+
+// SLIP special characters
+#define SLIP_END		0xC0
+#define SLIP_ESC		0xDB
+#define SLIP_ESC_END	0xDC
+#define SLIP_ESC_ESC	0xDD
+
+typedef struct SerialFramer
+{
+	unsigned char framing;		// SERIAL_FRAMING_*, possibly with SERIAL_FRAMING_CRC8
+	char *buffer;
+	unsigned char size;			// the space for one frame
+	char *frame;				// where the frame being received goes
+	unsigned char length;		// decoded bytes of the frame being received
+	unsigned char state;		// SLIP: an escape is pending; COBS: bytes left in the block
+	unsigned char code;			// COBS: the code of the current block, 0 at the start
+	unsigned char crc;
+	unsigned char bad;			// the frame being received will be dropped
+	unsigned char started;		// a byte of the frame being received has arrived
+	unsigned long startTime;	// the tick count of that first byte
+	void (*callback)(char *frame, unsigned char length);
+
+	// The frame waiting for getFrame().  The interrupt only writes these
+	// while frameReady is 0 and the main loop only reads them while it is
+	// 1, so the pointer can be read without disabling interrupts.
+	char *readyFrame;
+	unsigned char readyLength;
+	unsigned long readyTime;
+	volatile unsigned char frameReady;
+
+	volatile unsigned char errors;
+} SerialFramer;
+
+static SerialFramer framers[_SERIAL_PORTS];
+
+
+#if _SERIAL_PORTS > 1
+
+extern "C" void serial_receive_frames(unsigned char port, unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length))
+{
+	OrangutanSerial::receiveFrames(port, framing, buffer, size, callback);
+}
+
+extern "C" char *serial_get_frame(unsigned char port, unsigned char *length)
+{
+	return OrangutanSerial::getFrame(port, length);
+}
+
+extern "C" void serial_release_frame(unsigned char port)
+{
+	OrangutanSerial::releaseFrame(port);
+}
+
+extern "C" unsigned char serial_get_frame_errors(unsigned char port)
+{
+	return OrangutanSerial::getFrameErrors(port);
+}
+
+extern "C" unsigned long serial_get_frame_time(unsigned char port)
+{
+	return OrangutanSerial::getFrameTime(port);
+}
+
+#else
+
+extern "C" void serial_receive_frames(unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length))
+{
+	OrangutanSerial::receiveFrames(framing, buffer, size, callback);
+}
+
+extern "C" char *serial_get_frame(unsigned char *length)
+{
+	return OrangutanSerial::getFrame(length);
+}
+
+extern "C" void serial_release_frame()
+{
+	OrangutanSerial::releaseFrame();
+}
+
+extern "C" unsigned char serial_get_frame_errors()
+{
+	return OrangutanSerial::getFrameErrors();
+}
+
+extern "C" unsigned long serial_get_frame_time()
+{
+	return OrangutanSerial::getFrameTime();
+}
+
+void OrangutanSerial::receiveFrames(unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length))
+{
+	receiveFrames(0, framing, buffer, size, callback);
+}
+
+char *OrangutanSerial::getFrame(unsigned char *length)
+{
+	return getFrame(0, length);
+}
+
+void OrangutanSerial::releaseFrame()
+{
+	releaseFrame(0);
+}
+
+unsigned char OrangutanSerial::getFrameErrors()
+{
+	return getFrameErrors(0);
+}
+
+unsigned long OrangutanSerial::getFrameTime()
+{
+	return getFrameTime(0);
+}
+
+#endif
+
+
+// CRC-8 with polynomial x^8 + x^2 + x + 1 (0x07), one bit at a time to
+// avoid a 256-byte table.
+static inline unsigned char crc8_update(unsigned char crc, unsigned char byte)
+{
+	unsigned char i;
+	crc ^= byte;
+	for (i = 0; i < 8; i++)
+		crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	return crc;
+}
+
+// Returns the current tick count.  This is copied from OrangutanTime::ticks()
+// since this is faster than calling the ticks() method.
+static inline unsigned long frame_time()
+{
+	unsigned char sreg = SREG;
+	cli();
+	unsigned long time = TCNT2 | tickCount;
+	if (TIFR2 & (1 << TOV2))	// if TCNT2 has overflowed since interrupts were disabled
+		time = TCNT2 | (tickCount + 256);	// see OrangutanTime::ticks()
+	SREG = sreg;
+	return time;
+}
+
+static void frame_error(SerialFramer *f)
+{
+	if (f->errors != 0xFF)
+		f->errors++;
+}
+
+static inline void frame_add(SerialFramer *f, unsigned char byte)
+{
+	if (f->bad)
+		return;
+
+	if (f->length >= f->size)
+	{
+		f->bad = 1;		// too long
+		return;
+	}
+
+	f->frame[f->length++] = byte;
+	if (f->framing & SERIAL_FRAMING_CRC8)
+		f->crc = crc8_update(f->crc, byte);
+}
+
+// Called when a delimiter arrives: delivers the frame if it is good and
+// gets ready for the next one.
+static void frame_end(SerialFramer *f)
+{
+	unsigned char length = f->length;
+
+	if (f->bad)
+		frame_error(f);
+	else if (length == 0)
+		;	// empty frames, e.g. from a SLIP END at both ends, are ignored
+	else if ((f->framing & SERIAL_FRAMING_CRC8) && f->crc != 0)
+		frame_error(f);
+	else
+	{
+		if (f->framing & SERIAL_FRAMING_CRC8)
+			length--;	// remove the CRC
+
+		if (f->callback)
+			f->callback(f->frame, length);
+		else if (!f->frameReady)
+		{
+			// hand this half of the buffer over and switch to the other one
+			f->readyFrame = f->frame;
+			f->readyLength = length;
+			f->readyTime = f->startTime;
+			f->frameReady = 1;
+			f->frame = (f->frame == f->buffer) ? f->buffer + f->size : f->buffer;
+		}
+		else
+			frame_error(f);	// no room
+	}
+
+	f->length = 0;
+	f->state = 0;
+	f->code = 0;
+	f->crc = 0;
+	f->bad = 0;
+	f->started = 0;
+}
+
+// The receive hook: decodes one received byte.  This is called from the
+// receive interrupt, so it must be quick.
+static void frame_byte(unsigned char port, unsigned char byte)
+{
+	SerialFramer *f = &framers[port];
+
+	if (!f->started)
+	{
+		f->started = 1;
+		f->startTime = frame_time();
+	}
+
+	switch (f->framing & ~SERIAL_FRAMING_CRC8)
+	{
+	case SERIAL_FRAMING_LINE:
+		if (byte == '\n')
+		{
+			frame_end(f);
+			return;
+		}
+		break;
+
+	case SERIAL_FRAMING_SLIP:
+		if (byte == SLIP_END)
+		{
+			if (f->state)
+				f->bad = 1;		// escape at the end of a frame
+			frame_end(f);
+			return;
+		}
+		if (f->state)
+		{
+			f->state = 0;
+			if (byte == SLIP_ESC_END)
+				byte = SLIP_END;
+			else if (byte == SLIP_ESC_ESC)
+				byte = SLIP_ESC;
+			else
+				f->bad = 1;		// invalid escape sequence
+		}
+		else if (byte == SLIP_ESC)
+		{
+			f->state = 1;
+			return;
+		}
+		break;
+
+	case SERIAL_FRAMING_COBS:
+		if (byte == 0)
+		{
+			if (f->state)
+				f->bad = 1;		// the last block was cut short
+			frame_end(f);
+			return;
+		}
+		if (f->state == 0)
+		{
+			// This byte is the code of a new block.  Every block but the
+			// first ends with a zero that was removed by the encoder, unless
+			// the block before it was a full one (code 0xFF).
+			unsigned char previous = f->code;
+			f->code = byte;
+			f->state = byte - 1;
+			if (previous == 0 || previous == 0xFF)
+				return;
+			byte = 0;
+		}
+		else
+			f->state--;
+		break;
+	}
+
+	frame_add(f, byte);
+}
+
+
+// Called by the receive interrupts below.  The receiveHook is always
+// frame_byte() when it is set for a UART, so it is called directly.
+inline void OrangutanSerial::serial_rx_handle_frame_byte(unsigned char port, unsigned char byte_received)
+{
+	if (ports[port].receiveHook)
+		frame_byte(port, byte_received);
+	else
+		serial_rx_store_byte(port, byte_received);
+}
+
+#ifdef USART_RX_vect
+ISR(USART_RX_vect)
+{
+	OrangutanSerial::serial_rx_handle_frame_byte(0, UDR0);
+}
+#endif
+
+#ifdef USART0_RX_vect
+ISR(USART0_RX_vect)
+{
+	OrangutanSerial::serial_rx_handle_frame_byte(0, UDR0);
+}
+#endif
+
+#ifdef USART1_RX_vect
+ISR(USART1_RX_vect)
+{
+	OrangutanSerial::serial_rx_handle_frame_byte(1, UDR1);
+}
+#endif
+
+
+// Starts decoding received bytes as frames.  See OrangutanSerial.h.
+void OrangutanSerial::receiveFrames(unsigned char port, unsigned char framing, char *buffer, unsigned char size, void (*callback)(char *frame, unsigned char length))
+{
+	SerialFramer *f = &framers[port];
+
+	// stop any receiving or framing already in progress
+#if _SERIAL_PORTS > 1
+	cancelReceive(port);
+#else
+	cancelReceive();
+#endif
+
+	if ((framing & ~SERIAL_FRAMING_CRC8) == SERIAL_FRAMING_NONE || buffer == 0)
+		return;
+
+	// make sure timer2 is running for getFrameTime()
+	OrangutanTime::ticks();
+
+	unsigned char sreg = SREG;
+	cli();
+
+	f->framing = framing;
+	f->buffer = buffer;
+	f->size = callback ? size : size / 2;
+	f->frame = buffer;
+	f->length = 0;
+	f->state = 0;
+	f->code = 0;
+	f->crc = 0;
+	f->bad = 0;
+	f->started = 0;
+	f->callback = callback;
+	f->frameReady = 0;
+	f->errors = 0;
+	ports[port].receiveHook = frame_byte;
+
+	SREG = sreg;
+}
+
+
+// Returns the frame waiting to be handled and its length, or 0 if there is
+// none.
+char *OrangutanSerial::getFrame(unsigned char port, unsigned char *length)
+{
+	SerialFramer *f = &framers[port];
+
+	if (!f->frameReady)
+		return 0;
+
+	*length = f->readyLength;
+	return f->readyFrame;
+}
+
+
+// Lets the frame returned by getFrame() be overwritten by the next one.
+void OrangutanSerial::releaseFrame(unsigned char port)
+{
+	framers[port].frameReady = 0;
+}
+
+
+unsigned char OrangutanSerial::getFrameErrors(unsigned char port)
+{
+	return framers[port].errors;
+}
+
+
+// Returns the tick count of the first byte of the frame being handled.
+unsigned long OrangutanSerial::getFrameTime(unsigned char port)
+{
+	SerialFramer *f = &framers[port];
+	return f->callback ? f->startTime : f->readyTime;
+}
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
@@ -0,0 +1,272 @@
+/*
+  OrangutanSerialCommands.cpp - Table-driven serial slave command engine.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#include "OrangutanSerialCommands.h"
+
+// The serial port, receive ring, and command table given to init().
+#if _SERIAL_PORTS > 1
+static unsigned char commands_port;
+#endif
+static const char *commands_ring;
+static SerialIndex commands_ring_size;
+static SerialIndex commands_read_index;
+static const SerialCommand *commands_table;
+static unsigned char commands_count;
+static void (*commands_error_handler)(unsigned char error, unsigned char byte);
+
+// The command being received, or 0 if we are waiting for a command byte,
+// and the data bytes collected for it so far.
+static const SerialCommand *command_current;
+static unsigned char *command_arguments;
+static unsigned char command_arguments_size;
+static unsigned char command_length;		// data bytes expected
+static unsigned char command_received;		// data bytes received
+static unsigned char command_length_pending;	// waiting for the length byte of a variable length command
+static unsigned char command_skipping;		// dropping the data bytes of a rejected command
+
+
+// OrangutanSerial hides the port argument on devices with one port, so
+// these helpers keep the #ifs in one place.
+static inline SerialIndex serial_received_bytes()
+{
+#if _SERIAL_PORTS > 1
+	return OrangutanSerial::getReceivedBytes(commands_port);
+#else
+	return OrangutanSerial::getReceivedBytes();
+#endif
+}
+
+static inline unsigned char serial_mode()
+{
+#if _SERIAL_PORTS > 1
+	return OrangutanSerial::getMode(commands_port);
+#else
+	return OrangutanSerial::getMode();
+#endif
+}
+
+
+#if _SERIAL_PORTS > 1
+extern "C" void serial_commands_init(unsigned char port, const SerialCommand *commands, unsigned char count,
+	char *receive_buffer, SerialIndex receive_size, unsigned char *arguments, unsigned char arguments_size)
+{
+	OrangutanSerialCommands::init(port, commands, count, receive_buffer, receive_size, arguments, arguments_size);
+}
+#else
+extern "C" void serial_commands_init(const SerialCommand *commands, unsigned char count,
+	char *receive_buffer, SerialIndex receive_size, unsigned char *arguments, unsigned char arguments_size)
+{
+	OrangutanSerialCommands::init(commands, count, receive_buffer, receive_size, arguments, arguments_size);
+}
+#endif
+
+extern "C" unsigned char serial_commands_check()
+{
+	return OrangutanSerialCommands::check();
+}
+
+extern "C" void serial_commands_reply(const char *buffer, SerialIndex size)
+{
+	OrangutanSerialCommands::reply(buffer, size);
+}
+
+extern "C" void serial_commands_set_error_handler(void (*handler)(unsigned char error, unsigned char byte))
+{
+	OrangutanSerialCommands::setErrorHandler(handler);
+}
+
+
+#if _SERIAL_PORTS > 1
+void OrangutanSerialCommands::init(unsigned char port, const SerialCommand *commands, unsigned char count,
+	char *receiveBuffer, SerialIndex receiveSize, unsigned char *arguments, unsigned char argumentsSize)
+#else
+void OrangutanSerialCommands::init(const SerialCommand *commands, unsigned char count,
+	char *receiveBuffer, SerialIndex receiveSize, unsigned char *arguments, unsigned char argumentsSize)
+#endif
+{
+#if _SERIAL_PORTS > 1
+	commands_port = port;
+	OrangutanSerial::receiveRing(port, receiveBuffer, receiveSize);
+#else
+	OrangutanSerial::receiveRing(receiveBuffer, receiveSize);
+#endif
+
+	commands_ring = receiveBuffer;
+	commands_ring_size = receiveSize;
+	commands_read_index = 0;
+	commands_table = commands;
+	commands_count = count;
+	command_current = 0;
+	command_skipping = 0;
+	command_arguments = arguments;
+	command_arguments_size = argumentsSize;
+}
+
+
+void OrangutanSerialCommands::setErrorHandler(void (*handler)(unsigned char error, unsigned char byte))
+{
+	commands_error_handler = handler;
+}
+
+
+static void command_error(unsigned char error, unsigned char byte)
+{
+	if (commands_error_handler)
+		commands_error_handler(error, byte);
+}
+
+
+// Calls the handler of the command that was just completed.
+inline void OrangutanSerialCommands::dispatch()
+{
+	const SerialCommand *command = command_current;
+
+	command_current = 0;
+	command->handler(command_arguments, command_length);
+}
+
+
+// Advances the parser by one received byte.  Returns 1 if this completed
+// a command.
+inline unsigned char OrangutanSerialCommands::handleByte(unsigned char byte)
+{
+	if (byte & 0x80)
+	{
+		if (command_current)
+			command_error(SERIAL_COMMAND_INCOMPLETE, command_current->command);
+		command_skipping = 0;
+
+		// look the command up in the table
+		unsigned char i;
+		command_current = 0;
+		for (i = 0; i < commands_count; i++)
+		{
+			if (commands_table[i].command == byte)
+			{
+				command_current = &commands_table[i];
+				break;
+			}
+		}
+
+		if (!command_current)
+		{
+			command_error(SERIAL_COMMAND_UNKNOWN, byte);
+			command_skipping = 1;
+			return 0;
+		}
+
+		command_received = 0;
+		command_length = command_current->argumentBytes;
+		command_length_pending = (command_length == SERIAL_COMMAND_VARIABLE_LENGTH);
+	}
+	else
+	{
+		if (!command_current)
+		{
+			if (!command_skipping)
+				command_error(SERIAL_COMMAND_UNEXPECTED_DATA, byte);
+			return 0;
+		}
+
+		if (command_length_pending)
+		{
+			command_length_pending = 0;
+			command_length = byte;
+		}
+		else
+			command_arguments[command_received++] = byte;
+	}
+
+	if (command_length_pending)
+		return 0;
+
+	if (command_length > command_arguments_size)
+	{
+		command_error(SERIAL_COMMAND_TOO_LONG, command_current->command);
+		command_current = 0;
+		command_skipping = 1;
+		return 0;
+	}
+
+	if (command_received < command_length)
+		return 0;
+
+	dispatch();
+	return 1;
+}
+
+
+// Handles everything that has arrived in the receive ring.
+unsigned char OrangutanSerialCommands::check()
+{
+	unsigned char handled = 0;
+
+	if (serial_mode() == SERIAL_CHECK)
+		OrangutanSerial::check();
+
+	while (commands_read_index != serial_received_bytes())
+	{
+		unsigned char byte = commands_ring[commands_read_index];
+		if (++commands_read_index >= commands_ring_size)
+			commands_read_index = 0;
+
+		handled += handleByte(byte);
+	}
+
+	return handled;
+}
+
+
+void OrangutanSerialCommands::reply(const char *buffer, SerialIndex size)
+{
+#if _SERIAL_PORTS > 1
+	unsigned char port = commands_port;
+	while (!OrangutanSerial::queueSend(port, buffer, size))
+	{
+		// If the whole queue is free and the reply still does not fit (or
+		// there is no queue), it can only be sent directly.
+		if (OrangutanSerial::sendQueueEmpty(port))
+		{
+			OrangutanSerial::sendBlocking(port, (char *)buffer, size);
+			return;
+		}
+		OrangutanSerial::check();
+	}
+#else
+	while (!OrangutanSerial::queueSend(buffer, size))
+	{
+		if (OrangutanSerial::sendQueueEmpty())
+		{
+			OrangutanSerial::sendBlocking((char *)buffer, size);
+			return;
+		}
+		OrangutanSerial::check();
+	}
+#endif
+}
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
@@ -0,0 +1,126 @@
+/*
+  OrangutanSerialCommands.h - Table-driven serial slave command engine.
+	Parses commands in the format used by the 3pi serial slave program: a
+	command byte (0x80-0xFF) followed by data bytes (0x00-0x7F).  The
+	program registers a table of commands, each with the number of data
+	bytes it takes and a function to handle it, and calls check() in its
+	main loop.  check() never waits: it consumes whatever has arrived in
+	the receive ring and calls the handler of each command as soon as its
+	last data byte arrives.  Replies sent with reply() go through the
+	OrangutanSerial send queue, so a master can send commands back to
+	back without waiting for each reply.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#ifndef OrangutanSerialCommands_h
+#define OrangutanSerialCommands_h
+
+#include "../OrangutanSerial/OrangutanSerial.h"
+
+// For SerialCommand.argumentBytes: the first data byte is the number of
+// data bytes that follow it, as in the 3pi serial slave's print command.
+#define SERIAL_COMMAND_VARIABLE_LENGTH	0xFF
+
+// Errors passed to the error handler, along with the offending byte
+#define SERIAL_COMMAND_UNKNOWN			1	// no command in the table has this byte
+#define SERIAL_COMMAND_INCOMPLETE		2	// a command byte arrived before all the data of the previous command
+#define SERIAL_COMMAND_UNEXPECTED_DATA	3	// a data byte arrived without a command
+#define SERIAL_COMMAND_TOO_LONG			4	// the data does not fit in the argument buffer
+
+typedef struct SerialCommand
+{
+	unsigned char command;			// 0x80-0xFF
+	unsigned char argumentBytes;	// number of data bytes, or SERIAL_COMMAND_VARIABLE_LENGTH
+
+	// Called from check() with the command's data bytes.  For variable
+	// length commands, the length byte is not included.
+	void (*handler)(const unsigned char *arguments, unsigned char length);
+} SerialCommand;
+
+#ifdef __cplusplus
+
+class OrangutanSerialCommands
+{
+  public:
+
+	// init: Starts receiving commands into the ring buffer receiveBuffer,
+	// using receiveRing().  The data bytes of each command are collected
+	// in arguments, so argumentsSize limits the amount of data a command
+	// can take.  The ring must be large enough to hold everything that can
+	// arrive between calls to check().  The command table is not copied, so
+	// it must stay valid.
+	// For pipelined replies, also give the port a send queue with
+	// OrangutanSerial::setSendQueue().
+
+	// check: Handles the bytes received since the last call, calling the
+	// handler of every command that is completed.  In SERIAL_CHECK mode,
+	// this also calls OrangutanSerial::check().  Returns the number of
+	// commands handled.  Handlers must not call check().
+
+	// reply: Sends a reply.  If the port has a send queue, the reply is
+	// queued and this only waits if the queue does not have room for it;
+	// otherwise it is sent with sendBlocking().
+
+	// setErrorHandler: Sets a function to be called from check() with one
+	// of the SERIAL_COMMAND_* errors above and the offending byte.
+	// Unknown commands are skipped along with the data bytes after them.
+
+#if _SERIAL_PORTS > 1
+	static void init(unsigned char port, const SerialCommand *commands, unsigned char count,
+		char *receiveBuffer, SerialIndex receiveSize, unsigned char *arguments, unsigned char argumentsSize);
+#else
+	static void init(const SerialCommand *commands, unsigned char count,
+		char *receiveBuffer, SerialIndex receiveSize, unsigned char *arguments, unsigned char argumentsSize);
+#endif
+	static unsigned char check();
+	static void reply(const char *buffer, SerialIndex size);
+	static void setErrorHandler(void (*handler)(unsigned char error, unsigned char byte));
+
+  private:
+	static inline unsigned char handleByte(unsigned char byte);
+	static inline void dispatch();
+};
+
+extern "C" {
+#endif // __cplusplus
+
+#if _SERIAL_PORTS > 1
+void serial_commands_init(unsigned char port, const SerialCommand *commands, unsigned char count,
+	char *receive_buffer, SerialIndex receive_size, unsigned char *arguments, unsigned char arguments_size);
+#else
+void serial_commands_init(const SerialCommand *commands, unsigned char count,
+	char *receive_buffer, SerialIndex receive_size, unsigned char *arguments, unsigned char arguments_size);
+#endif
+unsigned char serial_commands_check(void);
+void serial_commands_reply(const char *buffer, SerialIndex size);
+void serial_commands_set_error_handler(void (*handler)(unsigned char error, unsigned char byte));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
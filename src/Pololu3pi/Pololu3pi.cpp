@@ -27,8 +27,8 @@
 #include "../PololuQTRSensors/PololuQTRSensors.h"
 #include "../OrangutanAnalog/OrangutanAnalog.h"
 
-// a global qtr sensors
-static PololuQTRSensorsRC qtr3pi;
+// a global qtr sensors; the 3pi always has exactly five
+static PololuQTRSensorsRCStatic<5> qtr3pi;
 
 #ifndef ARDUINO
 // only needed for lib-pololu
@@ -85,6 +85,11 @@ extern "C" unsigned int read_line_white(unsigned int *sensor_values, unsigned ch
 	return qtr3pi.readLine(sensor_values, readMode, 1);
 }
 
+extern "C" void line_sensors_set_adaptive_timeout(unsigned char enable, unsigned int margin)
+{
+	qtr3pi.setAdaptiveTimeout(enable, margin);
+}
+
 extern "C" unsigned int *get_line_sensors_calibrated_minimum_on()
 {
 	return qtr3pi.calibratedMinimumOn;
@@ -112,9 +117,9 @@ void Pololu3pi::init(unsigned int line_sensor_timeout_us, unsigned char disable_
 	// The sensors are on PC0..4, and the emitter is on PC5.
 	unsigned char pins[5] = {14,15,16,17,18};
 	if(disable_emitter_pin)
-		qtr3pi.init(pins,5,line_sensor_timeout_us,255);
+		qtr3pi.init(pins,line_sensor_timeout_us,255);
 	else
-		qtr3pi.init(pins,5,line_sensor_timeout_us,19);
+		qtr3pi.init(pins,line_sensor_timeout_us,19);
 
 	qtr3pi.emittersOff();
 
@@ -159,6 +164,11 @@ unsigned int Pololu3pi::readLine(unsigned int *sensor_values, unsigned char read
 	return qtr3pi.readLine(sensor_values, readMode, white_line);
 }
 
+void Pololu3pi::setLineSensorsAdaptiveTimeout(unsigned char enable, unsigned int margin)
+{
+	qtr3pi.setAdaptiveTimeout(enable, margin);
+}
+
 unsigned int *Pololu3pi::getLineSensorsCalibratedMinimumOn()
 {
 	return qtr3pi.calibratedMinimumOn;
@@ -81,6 +81,12 @@ public:
 	void lineSensorsResetCalibration();
 	unsigned int readLine(unsigned int *sensor_values, unsigned char readMode = IR_EMITTERS_ON, unsigned char white_line = 0);
 
+	// Once the line sensors are calibrated, lets readings stop as soon as
+	// every sensor has discharged or passed its calibrated maximum plus
+	// margin, instead of always waiting for the full timeout passed to
+	// init().  See PololuQTRSensorsRCBase::setAdaptiveTimeout().
+	void setLineSensorsAdaptiveTimeout(unsigned char enable, unsigned int margin = 100);
+
 	unsigned int *getLineSensorsCalibratedMinimumOn();
 	unsigned int *getLineSensorsCalibratedMaximumOn();
 	unsigned int *getLineSensorsCalibratedMinimumOff();
@@ -100,6 +106,7 @@ void line_sensors_reset_calibration(void);
 void read_line_sensors_calibrated(unsigned int *sensor_values, unsigned char readMode);
 unsigned int read_line(unsigned int *sensor_values, unsigned char readMode);
 unsigned int read_line_white(unsigned int *sensor_values, unsigned char readMode);
+void line_sensors_set_adaptive_timeout(unsigned char enable, unsigned int margin);
 
 unsigned int *get_line_sensors_calibrated_minimum_on(void);
 unsigned int *get_line_sensors_calibrated_maximum_on(void);
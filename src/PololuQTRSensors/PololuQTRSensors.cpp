@@ -35,6 +35,7 @@
 #define F_CPU 20000000UL
 #endif
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <stdlib.h>
 #include "PololuQTRSensors.h"
 
@@ -53,6 +54,7 @@
 
 #ifndef ARDUINO
 #include "../OrangutanTime/OrangutanTime.h"		// provides access to delay routines
+#include "../OrangutanAnalog/OrangutanAnalog.h"	// provides the ADC clock profile
 #else
 #include <Arduino.h> // provides access to delay() and delayMicroseconds()
 #endif
@@ -60,6 +62,14 @@
 // one pointer to the type in use
 static PololuQTRSensors *qtr;
 
+// Gives the C functions in PololuQTRSensorsRCAsync.cpp access to the
+// object above.  Those functions live in a separate object file so that
+// their pin-change ISR is only linked into programs that use them.
+PololuQTRSensors *qtr_c_object()
+{
+	return qtr;
+}
+
 extern "C" void qtr_emitters_on()
 {
 	qtr->emittersOn();
@@ -141,6 +151,31 @@ extern "C" unsigned int *qtr_calibrated_maximum_off()
 	return qtr->calibratedMaximumOff;
 }
 
+extern "C" void qtr_set_emitter_settle_time(unsigned int microseconds)
+{
+	qtr->setEmitterSettleTime(microseconds);
+}
+
+extern "C" void qtr_set_emitter_pipelining(unsigned char enable)
+{
+	qtr->setEmitterPipelining(enable);
+}
+
+extern "C" void qtr_set_continuous_calibration(unsigned char decayPeriod, unsigned int minimumSpan)
+{
+	qtr->setContinuousCalibration(decayPeriod, minimumSpan);
+}
+
+extern "C" void qtr_set_edge_logging(unsigned char enable)
+{
+	((PololuQTRSensorsRCBase *)qtr)->setEdgeLogging(enable);
+}
+
+extern "C" void qtr_set_adaptive_timeout(unsigned char enable, unsigned int margin)
+{
+	((PololuQTRSensorsRCBase *)qtr)->setAdaptiveTimeout(enable, margin);
+}
+
 
 // Base class data member initialization (called by derived class init())
 void PololuQTRSensors::init(unsigned char numSensors, 
@@ -150,6 +185,11 @@ void PololuQTRSensors::init(unsigned char numSensors,
 	calibratedMaximumOn=0;
 	calibratedMinimumOff=0;
 	calibratedMaximumOff=0;
+	_calibrationScale[QTR_EMITTERS_OFF]=0;
+	_calibrationScale[QTR_EMITTERS_ON]=0;
+	_calibrationScale[QTR_EMITTERS_ON_AND_OFF]=0;
+	_calibrationStorage=0;
+	_scaleStorage=0;
 
 	if (numSensors > QTR_MAX_SENSORS)
 		_numSensors = QTR_MAX_SENSORS;
@@ -158,6 +198,14 @@ void PololuQTRSensors::init(unsigned char numSensors,
 		
 	_type = type;
 
+	_emitterSettleTime = 200;
+	_emitterState = QTR_EMITTERS_OFF;
+	_emittersSettled = 0;
+	_emitterPipelining = 0;
+
+	_calibrationDecayPeriod = 0;
+	_calibrating = 0;
+
 	struct IOStruct emitterIO;
 	OrangutanDigital::getIORegisters(&emitterIO, emitterPin);
     _emitterBitmask = emitterIO.bitmask;
@@ -178,57 +226,147 @@ void PololuQTRSensors::read(unsigned int *sensor_values, unsigned char readMode)
 {
 	unsigned int off_values[QTR_MAX_SENSORS];
 	unsigned char i;
-	
-	if(readMode == QTR_EMITTERS_ON || readMode == QTR_EMITTERS_ON_AND_OFF)
-		emittersOn();
 
-	if (_type == QTR_RC)
+	// a background scan has already done all the work
+	if (_type == QTR_A && ((PololuQTRSensorsAnalogBase*)this)->readScanFrame(sensor_values))
+		return;
+
+	if(readMode == QTR_EMITTERS_ON_AND_OFF)
 	{
-		((PololuQTRSensorsRC*)this)->readPrivate(sensor_values);
-		emittersOff();
-		if(readMode == QTR_EMITTERS_ON_AND_OFF)
-			((PololuQTRSensorsRC*)this)->readPrivate(off_values);
+		readOnAndOff(sensor_values, off_values);
+
+		for(i=0;i<_numSensors;i++)
+		{
+			sensor_values[i] += _maxValue - off_values[i];
+		}
 	}
 	else
 	{
-		((PololuQTRSensorsAnalog*)this)->readPrivate(sensor_values);
-		emittersOff();
-		if(readMode == QTR_EMITTERS_ON_AND_OFF)
-			((PololuQTRSensorsAnalog*)this)->readPrivate(off_values);
+		// calibrate() needs to see the full range of readings, so it
+		// does not use the adaptive timeout
+		readPhase(sensor_values, readMode, !_calibrating);
+		emittersOffNoWait();
 	}
+}
 
-	if(readMode == QTR_EMITTERS_ON_AND_OFF)
+
+// Reads the sensors with the emitters on and with them off, for
+// QTR_EMITTERS_ON_AND_OFF mode.
+void PololuQTRSensors::readOnAndOff(unsigned int *on_values, unsigned int *off_values)
+{
+	// when pipelining, start with whichever half of the reading the
+	// emitters are already settled for, and leave them as they are
+	if(_emitterPipelining)
 	{
-		for(i=0;i<_numSensors;i++)
+		if(_emittersSettled && _emitterState == QTR_EMITTERS_OFF)
 		{
-			sensor_values[i] += _maxValue - off_values[i];
+			readPhase(off_values, QTR_EMITTERS_OFF);
+			readPhase(on_values, QTR_EMITTERS_ON);
+		}
+		else
+		{
+			readPhase(on_values, QTR_EMITTERS_ON);
+			readPhase(off_values, QTR_EMITTERS_OFF);
+		}
+		return;
+	}
+
+	readPhase(on_values, QTR_EMITTERS_ON);
+	readPhase(off_values, QTR_EMITTERS_OFF);
+	emittersOffNoWait();
+}
+
+
+// Turns the emitters off at the end of a reading.  There is no need to
+// wait for the sensors to react; the next reading will do that if it
+// needs to.
+void PololuQTRSensors::emittersOffNoWait()
+{
+	setEmitters(QTR_EMITTERS_OFF);
+	_emittersSettled = 0;
+}
+
+
+// Sets the emitters to the given state and reads the sensors once they
+// have reacted.  QTR-RC sensors are charged while the emitters settle.
+// If adaptive is true, QTR-RC sensors may use the calibration for this
+// emitter state to end the reading early (see setAdaptiveTimeout()).
+void PololuQTRSensors::readPhase(unsigned int *sensor_values, unsigned char emitterState,
+	unsigned char adaptive)
+{
+	unsigned int settleTime = setEmitters(emitterState);
+
+	if (_type == QTR_RC)
+	{
+		unsigned int *calibratedMinimum = 0, *calibratedMaximum = 0;
+		if (adaptive && emitterState == QTR_EMITTERS_ON)
+		{
+			calibratedMinimum = calibratedMinimumOn;
+			calibratedMaximum = calibratedMaximumOn;
+		}
+		else if (adaptive)
+		{
+			calibratedMinimum = calibratedMinimumOff;
+			calibratedMaximum = calibratedMaximumOff;
 		}
+		((PololuQTRSensorsRCBase*)this)->readPrivate(sensor_values, settleTime,
+			calibratedMinimum, calibratedMaximum);
+	}
+	else
+	{
+		if (settleTime)
+			delayMicroseconds(settleTime);
+		((PololuQTRSensorsAnalogBase*)this)->readPrivate(sensor_values);
 	}
 }
 
 
+// Drives the emitter pin to the given state without waiting.  Returns the
+// number of microseconds the caller must wait for the sensors to react.
+unsigned int PololuQTRSensors::setEmitters(unsigned char state)
+{
+	if (_emitterDDR == 0)
+		return 0;	// the emitters are always on
+	*_emitterDDR |= _emitterBitmask;
+	if (state == QTR_EMITTERS_ON)
+		*_emitterPORT |= _emitterBitmask;
+	else
+		*_emitterPORT &= ~_emitterBitmask;
+
+	if (_emittersSettled && state == _emitterState)
+		return 0;
+	_emitterState = state;
+	_emittersSettled = 1;	// by the time the caller is done waiting
+	return _emitterSettleTime;
+}
+
+void PololuQTRSensors::setEmitterSettleTime(unsigned int microseconds)
+{
+	_emitterSettleTime = microseconds;
+}
+
+void PololuQTRSensors::setEmitterPipelining(unsigned char enable)
+{
+	_emitterPipelining = enable;
+}
+
+
 // Turn the IR LEDs off and on.  This is mainly for use by the
 // read method, and calling these functions before or
 // after the reading the sensors will have no effect on the
 // readings, but you may wish to use these for testing purposes.
 void PololuQTRSensors::emittersOff()
 {
-	if (_emitterDDR == 0)
-		return;
-	*_emitterDDR |= _emitterBitmask;
-	*_emitterPORT &= ~_emitterBitmask;
-
-	delayMicroseconds(200);  // Give the sensors time to react.
+	unsigned int settleTime = setEmitters(QTR_EMITTERS_OFF);
+	if (settleTime)
+		delayMicroseconds(settleTime);  // Give the sensors time to react.
 }
 
 void PololuQTRSensors::emittersOn()
 {
-  if (_emitterDDR == 0)
-		return;
-	*_emitterDDR |= _emitterBitmask;
-	*_emitterPORT |= _emitterBitmask;
-
-	delayMicroseconds(200);  // Give the sensors time to react.
+	unsigned int settleTime = setEmitters(QTR_EMITTERS_ON);
+	if (settleTime)
+		delayMicroseconds(settleTime);  // Give the sensors time to react.
 }
 
 // Resets the calibration.
@@ -270,23 +408,29 @@ void PololuQTRSensors::calibrate(unsigned char readMode)
 	}
 }
 
-void PololuQTRSensors::calibrateOnOrOff(unsigned int **calibratedMinimum,
-										unsigned int **calibratedMaximum,
-										unsigned char readMode)
+// Allocates the given calibration arrays if necessary.  Returns 0 if
+// there is not enough memory.
+unsigned char PololuQTRSensors::allocateCalibration(unsigned int **calibratedMinimum,
+													unsigned int **calibratedMaximum)
 {
 	int i;
-	unsigned int sensor_values[16];
-	unsigned int max_sensor_values[16];
-	unsigned int min_sensor_values[16];
 
-	// Allocate the arrays if necessary.
+	// Use the storage provided by a derived class if there is any.  The
+	// On arrays come first, minimum before maximum.
+	unsigned int *storage = _calibrationStorage;
+	if(storage && calibratedMinimum != &calibratedMinimumOn)
+		storage += 2*_numSensors;
+
 	if(*calibratedMaximum == 0)
 	{
-		*calibratedMaximum = (unsigned int*)malloc(sizeof(unsigned int)*_numSensors);
+		if(storage)
+			*calibratedMaximum = storage + _numSensors;
+		else
+			*calibratedMaximum = (unsigned int*)malloc(sizeof(unsigned int)*_numSensors);
 
 		// If the malloc failed, don't continue.
 		if(*calibratedMaximum == 0)
-			return;
+			return 0;
 
 		// Initialize the max and min calibrated values to values that
 		// will cause the first reading to update them.
@@ -296,16 +440,36 @@ void PololuQTRSensors::calibrateOnOrOff(unsigned int **calibratedMinimum,
 	}
 	if(*calibratedMinimum == 0)
 	{
-		*calibratedMinimum = (unsigned int*)malloc(sizeof(unsigned int)*_numSensors);
+		if(storage)
+			*calibratedMinimum = storage;
+		else
+			*calibratedMinimum = (unsigned int*)malloc(sizeof(unsigned int)*_numSensors);
 
 		// If the malloc failed, don't continue.
 		if(*calibratedMinimum == 0)
-			return;
+			return 0;
 
 		for(i=0;i<_numSensors;i++)
 			(*calibratedMinimum)[i] = _maxValue;
 	}
 
+	return 1;
+}
+
+void PololuQTRSensors::calibrateOnOrOff(unsigned int **calibratedMinimum,
+										unsigned int **calibratedMaximum,
+										unsigned char readMode)
+{
+	int i;
+	unsigned int sensor_values[16];
+	unsigned int max_sensor_values[16];
+	unsigned int min_sensor_values[16];
+
+	// Allocate the arrays if necessary.
+	if(!allocateCalibration(calibratedMinimum, calibratedMaximum))
+		return;
+
+	_calibrating = 1;
 	int j;
 	for(j=0;j<10;j++)
 	{
@@ -321,6 +485,7 @@ void PololuQTRSensors::calibrateOnOrOff(unsigned int **calibratedMinimum,
 				min_sensor_values[i] = sensor_values[i];
 		}
 	}
+	_calibrating = 0;
 
 	// record the min and max calibration values
 	for(i=0;i<_numSensors;i++)
@@ -333,6 +498,96 @@ void PololuQTRSensors::calibrateOnOrOff(unsigned int **calibratedMinimum,
 }
 
 
+// Enables or disables continuous calibration.  See the header file.
+void PololuQTRSensors::setContinuousCalibration(unsigned char decayPeriod,
+												unsigned int minimumSpan)
+{
+	_calibrationDecayPeriod = decayPeriod;
+	_calibrationMinimumSpan = minimumSpan;
+	_calibrationReadCount = 0;
+}
+
+
+// Reads the sensors for readCalibrated() in continuous calibration mode
+// and updates the calibration arrays, which must already be allocated,
+// with the raw readings.
+void PololuQTRSensors::readAndUpdateCalibration(unsigned int *sensor_values,
+												unsigned char readMode)
+{
+	unsigned int off_values[QTR_MAX_SENSORS];
+	unsigned char i, decay = 0;
+
+	if(++_calibrationReadCount >= _calibrationDecayPeriod)
+	{
+		_calibrationReadCount = 0;
+		decay = 1;
+	}
+
+	// The on and off readings are calibrated separately, so they are
+	// needed before they are combined.  A background scan only provides
+	// one of them, in which case the calibration is left alone.
+	if(readMode == QTR_EMITTERS_ON_AND_OFF &&
+	   !(_type == QTR_A && ((PololuQTRSensorsAnalogBase*)this)->_scanFrame))
+	{
+		readOnAndOff(sensor_values, off_values);
+		updateCalibration(calibratedMinimumOn, calibratedMaximumOn, sensor_values, decay);
+		updateCalibration(calibratedMinimumOff, calibratedMaximumOff, off_values, decay);
+
+		for(i=0;i<_numSensors;i++)
+		{
+			sensor_values[i] += _maxValue - off_values[i];
+		}
+		return;
+	}
+
+	read(sensor_values, readMode);
+	if(readMode == QTR_EMITTERS_ON)
+		updateCalibration(calibratedMinimumOn, calibratedMaximumOn, sensor_values, decay);
+	else if(readMode == QTR_EMITTERS_OFF)
+		updateCalibration(calibratedMinimumOff, calibratedMaximumOff, sensor_values, decay);
+}
+
+
+// Widens the calibration bounds to include the given readings.  If decay
+// is true, also moves each bound 1/16 of the way toward the reading, as
+// long as that leaves at least _calibrationMinimumSpan between them, so
+// that bounds from old lighting conditions are gradually forgotten.
+void PololuQTRSensors::updateCalibration(unsigned int *calibratedMinimum,
+										 unsigned int *calibratedMaximum,
+										 unsigned int *sensor_values,
+										 unsigned char decay)
+{
+	unsigned char i;
+
+	for(i=0;i<_numSensors;i++)
+	{
+		unsigned int value = sensor_values[i];
+		unsigned int calmin = calibratedMinimum[i];
+		unsigned int calmax = calibratedMaximum[i];
+
+		if(value > calmax)
+			calmax = value;
+		if(value < calmin)
+			calmin = value;
+
+		// calmin <= value <= calmax now, so none of this can underflow
+		if(decay)
+		{
+			unsigned int newmin = calmin + ((value - calmin) >> 4);
+			unsigned int newmax = calmax - ((calmax - value) >> 4);
+			if(newmax - newmin >= _calibrationMinimumSpan)
+			{
+				calmin = newmin;
+				calmax = newmax;
+			}
+		}
+
+		calibratedMinimum[i] = calmin;
+		calibratedMaximum[i] = calmax;
+	}
+}
+
+
 // Returns values calibrated to a value between 0 and 1000, where
 // 0 corresponds to the minimum value read by calibrate() and 1000
 // corresponds to the maximum value.  Calibration values are
@@ -341,6 +596,17 @@ void PololuQTRSensors::calibrateOnOrOff(unsigned int **calibratedMinimum,
 void PololuQTRSensors::readCalibrated(unsigned int *sensor_values, unsigned char readMode)
 {
 	int i;
+	CalibrationScale *table;
+
+	// in continuous calibration mode, the readings themselves are used
+	// for calibration, so allocate the arrays if necessary
+	if(_calibrationDecayPeriod)
+	{
+		if(readMode == QTR_EMITTERS_ON_AND_OFF || readMode == QTR_EMITTERS_OFF)
+			allocateCalibration(&calibratedMinimumOff, &calibratedMaximumOff);
+		if(readMode == QTR_EMITTERS_ON_AND_OFF || readMode == QTR_EMITTERS_ON)
+			allocateCalibration(&calibratedMinimumOn, &calibratedMaximumOn);
+	}
 
 	// if not calibrated, do nothing
 	if(readMode == QTR_EMITTERS_ON_AND_OFF || readMode == QTR_EMITTERS_OFF)
@@ -350,8 +616,33 @@ void PololuQTRSensors::readCalibrated(unsigned int *sensor_values, unsigned char
 		if(!calibratedMinimumOn || !calibratedMaximumOn)
 			return;
 
+	// Allocate the scale table if necessary.  An all-zero entry is
+	// consistent (calmin == calmax, so scale is 0), so zeroing the table
+	// is enough to initialize it.  If the malloc fails, the scaling is
+	// done with a division instead.
+	table = _calibrationScale[readMode];
+	if(table == 0)
+	{
+		if(_scaleStorage)
+		{
+			table = _scaleStorage + readMode * _numSensors;
+			for(i=0;i<_numSensors;i++)
+			{
+				table[i].calmin = 0;
+				table[i].calmax = 0;
+				table[i].scale = 0;
+			}
+		}
+		else if(!_calibrationStorage)
+			table = (CalibrationScale*)calloc(_numSensors, sizeof(CalibrationScale));
+		_calibrationScale[readMode] = table;
+	}
+
 	// read the needed values
-	read(sensor_values,readMode);
+	if(_calibrationDecayPeriod)
+		readAndUpdateCalibration(sensor_values, readMode);
+	else
+		read(sensor_values,readMode);
 
 	for(i=0;i<_numSensors;i++)
 	{
@@ -383,6 +674,33 @@ void PololuQTRSensors::readCalibrated(unsigned int *sensor_values, unsigned char
 				calmax = calibratedMaximumOn[i] + _maxValue - calibratedMaximumOff[i]; // this won't go past _maxValue
 		}
 
+		if(table)
+		{
+			CalibrationScale *entry = &table[i];
+			unsigned int x = 0;
+
+			// this division only happens when the calibration changes
+			if(entry->calmin != calmin || entry->calmax != calmax)
+			{
+				entry->calmin = calmin;
+				entry->calmax = calmax;
+				entry->scale = 0;
+				if(calmax > calmin)
+					entry->scale = (1000UL * 65536 + (calmax - calmin) - 1) / (calmax - calmin);
+			}
+
+			// Clamp the reading to the calibrated range first so that the
+			// product fits in 32 bits and the result is at most 1000.
+			if(sensor_values[i] > calmin)
+			{
+				x = sensor_values[i] - calmin;
+				if(sensor_values[i] > calmax)
+					x = calmax - calmin;
+			}
+			sensor_values[i] = (x * entry->scale) >> 16;
+			continue;
+		}
+
 		denominator = calmax - calmin;
 
 		signed int x = 0;
@@ -514,6 +832,12 @@ PololuQTRSensorsRC::PololuQTRSensorsRC(unsigned char* pins,
 // use an invalid Arduino pin value (20 or greater).
 void PololuQTRSensorsRC::init(unsigned char* pins,
 	unsigned char numSensors, unsigned int timeout, unsigned char emitterPin)
+{
+	PololuQTRSensorsRCBase::init(pins, numSensors, timeout, emitterPin);
+}
+
+void PololuQTRSensorsRCBase::init(unsigned char* pins,
+	unsigned char numSensors, unsigned int timeout, unsigned char emitterPin)
 {
 	PololuQTRSensors::init(numSensors, emitterPin, QTR_RC);
 	
@@ -524,6 +848,8 @@ void PololuQTRSensorsRC::init(unsigned char* pins,
 	_portBMask = 0;
 	_portCMask = 0;
 	_portDMask = 0;
+	_edgeLogging = 0;
+	_adaptiveTimeout = 0;
 	
 	_maxValue = timeout;
 	for (i = 0; i < _numSensors; i++)
@@ -550,12 +876,39 @@ void PololuQTRSensorsRC::init(unsigned char* pins,
 // ...
 // The values returned are in microseconds and range from 0 to
 // timeout_us (as specified in the constructor).
-void PololuQTRSensorsRC::readPrivate(unsigned int *sensor_values)
+void PololuQTRSensorsRCBase::readPrivate(unsigned int *sensor_values, unsigned int chargeTime,
+	unsigned int *calibratedMinimum, unsigned int *calibratedMaximum)
 {
 	unsigned char i;
 	unsigned char last_time;
 	unsigned char delta_time;
 	unsigned int time = 0;
+	unsigned int timeout = _maxValue;
+	unsigned int limit[QTR_MAX_SENSORS];
+
+	// With the adaptive timeout, the reading ends once every sensor has
+	// either discharged or gone past its calibrated maximum plus the
+	// margin, since any later time would be scaled to 1000 anyway.
+	// Sensors that have not discharged by then read as their limit.
+	// A sensor whose calibrated maximum is not above its minimum, e.g.
+	// after resetCalibration() or at the start of continuous
+	// calibration, has not been calibrated yet and keeps the full timeout.
+	for (i = 0; i < _numSensors; i++)
+		limit[i] = _maxValue;
+	if (!_adaptiveTimeout || !calibratedMinimum)
+		calibratedMaximum = 0;
+	if (calibratedMaximum)
+	{
+		timeout = 0;
+		for (i = 0; i < _numSensors; i++)
+		{
+			if (calibratedMaximum[i] > calibratedMinimum[i] && calibratedMaximum[i] < _maxValue &&
+				_maxValue - calibratedMaximum[i] > _adaptiveTimeoutMargin)
+				limit[i] = calibratedMaximum[i] + _adaptiveTimeoutMargin;
+			if (limit[i] > timeout)
+				timeout = limit[i];
+		}
+	}
 
 	#ifdef _ORANGUTAN_XX4
 	unsigned char last_a = _portAMask;
@@ -576,7 +929,7 @@ void PololuQTRSensorsRC::readPrivate(unsigned int *sensor_values)
 	DDRC |= _portCMask;
 	DDRD |= _portDMask;
 	
-	// drive high for 10 us
+	// drive high for at least 10 us
 	#ifdef _ORANGUTAN_XX4
 	PORTA |= _portAMask;
 	#endif
@@ -584,7 +937,7 @@ void PololuQTRSensorsRC::readPrivate(unsigned int *sensor_values)
 	PORTC |= _portCMask;
 	PORTD |= _portDMask;
 	
-	delayMicroseconds(10);
+	delayMicroseconds(chargeTime > 10 ? chargeTime : 10);
 	
 	// set all ports to inputs
 	#ifdef _ORANGUTAN_XX4
@@ -609,7 +962,21 @@ void PololuQTRSensorsRC::readPrivate(unsigned int *sensor_values)
 						// this is compatible with OrangutanMotors
 
 	last_time = TCNT2;
-	while (time < _maxValue)
+	if (_edgeLogging)
+	{
+		time = readEdgeLog(sensor_values, &last_time, timeout,
+			calibratedMaximum ? limit : 0);
+
+		// if the log filled up, only wait for the remaining sensors
+		if (calibratedMaximum && time < timeout)
+		{
+			timeout = 0;
+			for (i = 0; i < _numSensors; i++)
+				if (sensor_values[i] == 0 && limit[i] > timeout)
+					timeout = limit[i];
+		}
+	}
+	while (time < timeout)
 	{
 		// Keep track of the total time.
 		// This implicitly casts the difference to unsigned char, so
@@ -639,13 +1006,309 @@ void PololuQTRSensorsRC::readPrivate(unsigned int *sensor_values)
 			if (sensor_values[i] == 0 && !(*_register[i] & _bitmask[i]))
 				sensor_values[i] = time;
 		}
+
+		// with the adaptive timeout, only wait for the remaining sensors
+		if (calibratedMaximum)
+		{
+			timeout = 0;
+			for (i = 0; i < _numSensors; i++)
+				if (sensor_values[i] == 0 && limit[i] > timeout)
+					timeout = limit[i];
+		}
 	}
 
 	TCCR2A = prevTCCR2A;
 	TCCR2B = prevTCCR2B;
 	for(i = 0; i < _numSensors; i++)
 		if (!sensor_values[i])
-			sensor_values[i] = _maxValue;
+			sensor_values[i] = limit[i];
+}
+
+
+// The number of pin changes that readEdgeLog() can record.  Each one
+// takes 5 bytes of stack (6 on the Orangutan SVP and X2).
+#define QTR_EDGE_LOG_SIZE	16
+
+// Records the time and state of the sensor pins each time one of them
+// changes, and then assigns each sensor the time of the first entry in
+// which its pin is low.  Stops when the timeout is reached, every sensor
+// has discharged, or the log is full.  If limit is not 0, it holds the
+// adaptive timeout of each sensor (see readPrivate()), and the timing
+// also stops once every sensor still charged has passed its limit.  The
+// sensors whose limits have not passed yet are kept as one mask per
+// port, so that checking this on each edge only takes a few mask
+// operations; the masks are only updated when the next limit passes.
+unsigned int PololuQTRSensorsRCBase::readEdgeLog(unsigned int *sensor_values,
+	unsigned char *last_time_ptr, unsigned int timeout, unsigned int *limit)
+{
+	unsigned int log_time[QTR_EDGE_LOG_SIZE];
+	#ifdef _ORANGUTAN_XX4
+	unsigned char log_a[QTR_EDGE_LOG_SIZE];
+	unsigned char mask_a = _portAMask, last_a = mask_a, a;
+	unsigned char pending_a = mask_a;
+	#endif
+	unsigned char log_b[QTR_EDGE_LOG_SIZE];
+	unsigned char log_c[QTR_EDGE_LOG_SIZE];
+	unsigned char log_d[QTR_EDGE_LOG_SIZE];
+	unsigned char mask_b = _portBMask, last_b = mask_b, b;
+	unsigned char mask_c = _portCMask, last_c = mask_c, c;
+	unsigned char mask_d = _portDMask, last_d = mask_d, d;
+	unsigned char pending_b = mask_b, pending_c = mask_c, pending_d = mask_d;
+	unsigned char last_time = *last_time_ptr;
+	unsigned char delta_time;
+	unsigned int time = 0;
+	// the time of the next adaptive limit, or the timeout; with limits,
+	// 0 makes the first pass find the first one
+	unsigned int wait = limit ? 0 : timeout;
+	unsigned char entries = 0;
+	unsigned char i, e;
+
+	while (entries < QTR_EDGE_LOG_SIZE)
+	{
+		// keep track of the total time, as in readPrivate()
+		delta_time = TCNT2 - last_time;
+		time += delta_time;
+		last_time += delta_time;
+
+		if (time >= wait)
+		{
+			if (!limit)
+			{
+				time = timeout;
+				break;
+			}
+
+			// stop waiting for the sensors whose limits have passed, and
+			// find the next limit
+			wait = timeout;
+			for (i = 0; i < _numSensors; i++)
+			{
+				if (limit[i] > time)
+				{
+					if (limit[i] < wait)
+						wait = limit[i];
+					continue;
+				}
+				#ifdef _ORANGUTAN_XX4
+				if (_register[i] == &PINA) pending_a &= ~_bitmask[i];
+				#endif
+				if (_register[i] == &PINB) pending_b &= ~_bitmask[i];
+				if (_register[i] == &PINC) pending_c &= ~_bitmask[i];
+				if (_register[i] == &PIND) pending_d &= ~_bitmask[i];
+			}
+
+			#ifdef _ORANGUTAN_XX4
+			if (!((last_a & pending_a) | (last_b & pending_b) | (last_c & pending_c) | (last_d & pending_d)))
+			#else
+			if (!((last_b & pending_b) | (last_c & pending_c) | (last_d & pending_d)))
+			#endif
+			{
+				time = timeout;
+				break;
+			}
+		}
+
+		// continue immediately if no sensor pin has changed
+		#ifdef _ORANGUTAN_XX4
+		a = PINA & mask_a;
+		#endif
+		b = PINB & mask_b;
+		c = PINC & mask_c;
+		d = PIND & mask_d;
+		#ifdef _ORANGUTAN_XX4
+		if (a == last_a && b == last_b && c == last_c && d == last_d) continue;
+		last_a = a;
+		log_a[entries] = a;
+		#else
+		if (b == last_b && c == last_c && d == last_d) continue;
+		#endif
+		last_b = b;
+		last_c = c;
+		last_d = d;
+
+		log_time[entries] = time;
+		log_b[entries] = b;
+		log_c[entries] = c;
+		log_d[entries] = d;
+		entries++;
+
+		// stop once every sensor has discharged or, with the adaptive
+		// timeout, passed its limit
+		#ifdef _ORANGUTAN_XX4
+		if (!((a & pending_a) | (b & pending_b) | (c & pending_c) | (d & pending_d)))
+		#else
+		if (!((b & pending_b) | (c & pending_c) | (d & pending_d)))
+		#endif
+		{
+			time = timeout;
+			break;
+		}
+	}
+
+	// figure out when each sensor changed
+	for (i = 0; i < _numSensors; i++)
+	{
+		volatile unsigned char *reg = _register[i];
+		unsigned char *log = log_d;
+		#ifdef _ORANGUTAN_XX4
+		if (reg == &PINA) log = log_a;
+		#endif
+		if (reg == &PINB) log = log_b;
+		if (reg == &PINC) log = log_c;
+
+		for (e = 0; e < entries; e++)
+		{
+			if (!(log[e] & _bitmask[i]))
+			{
+				sensor_values[i] = log_time[e];
+				break;
+			}
+		}
+	}
+
+	*last_time_ptr = last_time;
+	return time;
+}
+
+void PololuQTRSensorsRCBase::setEdgeLogging(unsigned char enable)
+{
+	_edgeLogging = enable;
+}
+
+void PololuQTRSensorsRCBase::setAdaptiveTimeout(unsigned char enable, unsigned int margin)
+{
+	_adaptiveTimeout = enable;
+	_adaptiveTimeoutMargin = margin;
+}
+
+
+// Reads several QTR-RC arrays at the same time.  This works like
+// readPrivate(), but with the port masks of all the arrays merged.
+void PololuQTRSensorsRCBase::readGroup(PololuQTRSensorsRCBase **arrays,
+	unsigned int **sensor_values, unsigned char numArrays, unsigned char readMode)
+{
+	unsigned char i, j;
+	unsigned char last_time;
+	unsigned char delta_time;
+	unsigned int time = 0;
+	unsigned int timeout = 0;
+	unsigned int settleTime = 0;
+	unsigned char emitterState = (readMode == QTR_EMITTERS_OFF) ?
+		QTR_EMITTERS_OFF : QTR_EMITTERS_ON;
+
+	#ifdef _ORANGUTAN_XX4
+	unsigned char portAMask = 0;
+	#endif
+	unsigned char portBMask = 0;
+	unsigned char portCMask = 0;
+	unsigned char portDMask = 0;
+
+	// set the emitters, merge the port masks, and reset the values
+	for (j = 0; j < numArrays; j++)
+	{
+		PololuQTRSensorsRCBase *array = arrays[j];
+		unsigned int t = array->setEmitters(emitterState);
+		if (t > settleTime)
+			settleTime = t;
+		if (array->_maxValue > timeout)
+			timeout = array->_maxValue;
+
+		#ifdef _ORANGUTAN_XX4
+		portAMask |= array->_portAMask;
+		#endif
+		portBMask |= array->_portBMask;
+		portCMask |= array->_portCMask;
+		portDMask |= array->_portDMask;
+
+		for (i = 0; i < array->_numSensors; i++)
+			sensor_values[j][i] = 0;
+	}
+
+	#ifdef _ORANGUTAN_XX4
+	unsigned char last_a = portAMask;
+	#endif
+	unsigned char last_b = portBMask;
+	unsigned char last_c = portCMask;
+	unsigned char last_d = portDMask;
+
+	// set all sensor pins to outputs and drive them high while the
+	// emitters settle (at least 10 us)
+	#ifdef _ORANGUTAN_XX4
+	DDRA |= portAMask;
+	PORTA |= portAMask;
+	#endif
+	DDRB |= portBMask;
+	PORTB |= portBMask;
+	DDRC |= portCMask;
+	PORTC |= portCMask;
+	DDRD |= portDMask;
+	PORTD |= portDMask;
+
+	delayMicroseconds(settleTime > 10 ? settleTime : 10);
+
+	// set all sensor pins to inputs and turn off the pull-ups
+	#ifdef _ORANGUTAN_XX4
+	DDRA &= ~portAMask;
+	PORTA &= ~portAMask;
+	#endif
+	DDRB &= ~portBMask;
+	PORTB &= ~portBMask;
+	DDRC &= ~portCMask;
+	PORTC &= ~portCMask;
+	DDRD &= ~portDMask;
+	PORTD &= ~portDMask;
+
+	unsigned char prevTCCR2A = TCCR2A;
+	unsigned char prevTCCR2B = TCCR2B;
+	TCCR2A |= 0x03;
+	TCCR2B = 0x02;		// run timer2 in normal mode at 2.5 MHz
+						// this is compatible with OrangutanMotors
+
+	last_time = TCNT2;
+	while (time < timeout)
+	{
+		// keep track of the total time, as in readPrivate()
+		delta_time = TCNT2 - last_time;
+		time += delta_time;
+		last_time += delta_time;
+
+		// continue immediately if there is no change
+		#ifdef _ORANGUTAN_XX4
+		if (PINA == last_a && PINB == last_b && PINC == last_c && PIND == last_d) continue;
+		last_a = PINA;
+		#else
+		if (PINB == last_b && PINC == last_c && PIND == last_d) continue;
+		#endif
+		last_b = PINB;
+		last_c = PINC;
+		last_d = PIND;
+
+		// figure out which pins changed, ignoring arrays that have
+		// already timed out
+		for (j = 0; j < numArrays; j++)
+		{
+			PololuQTRSensorsRCBase *array = arrays[j];
+			if (time >= array->_maxValue)
+				continue;
+			for (i = 0; i < array->_numSensors; i++)
+			{
+				if (sensor_values[j][i] == 0 && !(*array->_register[i] & array->_bitmask[i]))
+					sensor_values[j][i] = time;
+			}
+		}
+	}
+
+	TCCR2A = prevTCCR2A;
+	TCCR2B = prevTCCR2B;
+
+	for (j = 0; j < numArrays; j++)
+	{
+		PololuQTRSensorsRCBase *array = arrays[j];
+		for (i = 0; i < array->_numSensors; i++)
+			if (!sensor_values[j][i])
+				sensor_values[j][i] = array->_maxValue;
+		array->emittersOffNoWait();
+	}
 }
 
 
@@ -692,6 +1355,14 @@ PololuQTRSensorsAnalog::PololuQTRSensorsAnalog(unsigned char* analogPins,
 void PololuQTRSensorsAnalog::init(unsigned char* analogPins,
 	unsigned char numSensors, unsigned char numSamplesPerSensor,
 	unsigned char emitterPin)
+{
+	PololuQTRSensorsAnalogBase::init(analogPins, numSensors,
+		numSamplesPerSensor, emitterPin);
+}
+
+void PololuQTRSensorsAnalogBase::init(unsigned char* analogPins,
+	unsigned char numSensors, unsigned char numSamplesPerSensor,
+	unsigned char emitterPin)
 {
 	unsigned char i;
 	
@@ -711,6 +1382,7 @@ void PololuQTRSensorsAnalog::init(unsigned char* analogPins,
 	#endif
 
 	_maxValue = 1023; // this is the maximum returned by the A/D conversion
+	_scanFrame = 0;
 }
 
 
@@ -722,7 +1394,7 @@ void PololuQTRSensorsAnalog::init(unsigned char* analogPins,
 // The values returned are a measure of the reflectance in terms of a
 // 10-bit ADC average with higher values corresponding to lower 
 // reflectance (e.g. a black surface or a void).
-void PololuQTRSensorsAnalog::readPrivate(unsigned int *sensor_values)
+void PololuQTRSensorsAnalogBase::readPrivate(unsigned int *sensor_values)
 {
 	unsigned char i, j;
 	
@@ -743,7 +1415,12 @@ void PololuQTRSensorsAnalog::readPrivate(unsigned int *sensor_values)
 	ANALOG_DDR &= ~_portMask;
 	ANALOG_PORT &= ~_portMask;
 
-	ADCSRA = 0x87;	// configure the ADC
+	// configure the ADC
+	#ifndef ARDUINO
+	ADCSRA = OrangutanAnalog::getADCSRA();
+	#else
+	ADCSRA = 0x87;
+	#endif
 	for (j = 0; j < _numSamplesPerSensor; j++)
 	{
 		for (i = 0; i < _numSensors; i++)
@@ -766,9 +1443,39 @@ void PololuQTRSensorsAnalog::readPrivate(unsigned int *sensor_values)
 	ANALOG_DDR = ddr;
 }
 
+// Copies the most recent frame of a background scan (see scanStart()) into
+// sensor_values, converting the sums to rounded averages.  Returns 0 if no
+// scan is running.  This lives here rather than in
+// PololuQTRSensorsAnalogScan.cpp so that read() does not pull the ADC ISR
+// into programs that never scan.
+unsigned char PololuQTRSensorsAnalogBase::readScanFrame(unsigned int *sensor_values)
+{
+	unsigned char i;
+
+	if (_scanFrame == 0)
+		return 0;
+
+	// the ISR might publish a new frame while we are copying this one
+	unsigned char sreg = SREG;
+	cli();
+	unsigned int *frame = _scanFrame;
+	for (i = 0; i < _numSensors; i++)
+		sensor_values[i] = frame[i];
+	SREG = sreg;
+
+	for (i = 0; i < _numSensors; i++)
+		sensor_values[i] = (sensor_values[i] + (_numSamplesPerSensor >> 1)) /
+			_numSamplesPerSensor;
+	return 1;
+}
+
 // the destructor frees up allocated memory
 PololuQTRSensors::~PololuQTRSensors()
 {
+	// nothing was allocated if a derived class provided the storage
+	if(_calibrationStorage)
+		return;
+
 	if(calibratedMaximumOn)
 		free(calibratedMaximumOn);
 	if(calibratedMaximumOff)
@@ -777,6 +1484,12 @@ PololuQTRSensors::~PololuQTRSensors()
 		free(calibratedMinimumOn);
 	if(calibratedMinimumOff)
 		free(calibratedMinimumOff);
+	if(_calibrationScale[QTR_EMITTERS_OFF])
+		free(_calibrationScale[QTR_EMITTERS_OFF]);
+	if(_calibrationScale[QTR_EMITTERS_ON])
+		free(_calibrationScale[QTR_EMITTERS_ON]);
+	if(_calibrationScale[QTR_EMITTERS_ON_AND_OFF])
+		free(_calibrationScale[QTR_EMITTERS_ON_AND_OFF]);
 }
 
 
@@ -76,6 +76,21 @@ class PololuQTRSensors
 	// readings, but you may wish to use these for testing purposes.
 	void emittersOff();
 	void emittersOn();
+
+	// Sets the time, in microseconds, that the sensors are given to react
+	// after the emitters are turned on or off.  The default is 200 us.
+	// With QTR-RC sensors, the sensor capacitors are charged during this
+	// time, so it does not add to the length of a reading unless it is
+	// longer than the 10 us charge time.
+	void setEmitterSettleTime(unsigned int microseconds);
+
+	// If enable is true, reading with QTR_EMITTERS_ON_AND_OFF leaves the
+	// emitters in the state used by the second half of the reading, and
+	// the next reading starts with that half.  This way only one emitter
+	// settle time is spent per reading instead of two, at the cost of the
+	// emitters sometimes staying on between readings.  Disabled by
+	// default.
+	void setEmitterPipelining(unsigned char enable);
   
 	// Reads the sensors for calibration.  The sensor values are
 	// not returned; instead, the maximum and minimum values found
@@ -86,6 +101,19 @@ class PololuQTRSensors
 	// Resets all calibration that has been done.
 	void resetCalibration();
 
+	// Enables continuous calibration if decayPeriod is non-zero.  In this
+	// mode, every reading taken by readCalibrated() or readLine() is also
+	// used to update the calibration for its readMode, so a separate
+	// calibration pass is not needed and the calibration follows
+	// changes in lighting.  The calibrated minimum and maximum of each
+	// sensor are widened immediately to include each reading, and every
+	// decayPeriod readings they are each moved 1/16 of the way back
+	// toward the current reading, unless that would bring them closer
+	// together than minimumSpan (in the units returned by read()).
+	// The calibration starts from whatever calibrate() has recorded so
+	// far, if anything.  Pass 0 as the decayPeriod to disable.
+	void setContinuousCalibration(unsigned char decayPeriod, unsigned int minimumSpan = 100);
+
 	// Returns values calibrated to a value between 0 and 1000, where
 	// 0 corresponds to the minimum value read by calibrate() and 1000
 	// corresponds to the maximum value.  Calibration values are
@@ -152,28 +180,226 @@ class PololuQTRSensors
 	
 	unsigned int _maxValue; // the maximum value returned by this function
 
+	unsigned int _emitterSettleTime;	// in microseconds
+	unsigned char _emitterState;		// QTR_EMITTERS_ON or QTR_EMITTERS_OFF
+	unsigned char _emittersSettled;		// true if the sensors have had time
+										// to react to _emitterState
+	unsigned char _emitterPipelining;
+
+	// Drives the emitter pin to the given state (QTR_EMITTERS_ON or
+	// QTR_EMITTERS_OFF) without waiting.  Returns the number of
+	// microseconds the caller must wait before the sensors have reacted,
+	// which is 0 if they were already settled in that state.
+	unsigned int setEmitters(unsigned char state);
+
+	// Turns the emitters off at the end of a reading without waiting.
+	void emittersOffNoWait();
+
+	// The calibration bounds of a sensor together with the fixed-point
+	// factor that scales a reading between them to the range 0-1000:
+	// scale = ceil(1000 * 65536 / (calmax - calmin)), or 0 if calmax is
+	// not above calmin.
+	struct CalibrationScale
+	{
+		unsigned int calmin;
+		unsigned int calmax;
+		unsigned long scale;
+	};
+
+	// Memory provided by PololuQTRSensorsRCStatic and
+	// PololuQTRSensorsAnalogStatic so that nothing needs to be allocated
+	// with malloc(), or 0 for the other classes.  _calibrationStorage has
+	// room for the four calibration arrays.  _scaleStorage has room for
+	// three scale tables, one for each readMode, in the order of the
+	// QTR_EMITTERS_* constants.
+	unsigned int *_calibrationStorage;
+	CalibrationScale *_scaleStorage;
+
   private:
 	
 	unsigned char _type;	// the type of the derived class (QTR_RC
 							// or QTR_A)
 
+	// One table of scales for each readMode, indexed by the value of the
+	// QTR_EMITTERS_* constant.  Like the calibration arrays, they are
+	// allocated by readCalibrated() when first needed.  An entry is
+	// recomputed whenever the calibration values it was computed from
+	// change, so the calibration arrays can still be modified directly.
+	CalibrationScale *_calibrationScale[3];
+
 	// Handles the actual calibration. calibratedMinimum and
 	// calibratedMaximum are pointers to the requested calibration
 	// arrays, which will be allocated if necessary.
 	void calibrateOnOrOff(unsigned int **calibratedMinimum,
 						  unsigned int **calibratedMaximum,
 						  unsigned char readMode);
+
+	// Allocates the given calibration arrays if necessary.  Returns 0 if
+	// there is not enough memory.
+	unsigned char allocateCalibration(unsigned int **calibratedMinimum,
+									  unsigned int **calibratedMaximum);
+
+	// Continuous calibration (see setContinuousCalibration()).
+	unsigned char _calibrationDecayPeriod;	// 0 if disabled
+	unsigned char _calibrationReadCount;
+	unsigned int _calibrationMinimumSpan;
+	void readAndUpdateCalibration(unsigned int *sensor_values, unsigned char readMode);
+	void updateCalibration(unsigned int *calibratedMinimum,
+						   unsigned int *calibratedMaximum,
+						   unsigned int *sensor_values, unsigned char decay);
+
+	// Reads the sensors with the emitters on and with them off.
+	void readOnAndOff(unsigned int *on_values, unsigned int *off_values);
+
+	// Sets the emitters to the given state and reads the sensors once
+	// they have reacted.  If adaptive is true, the QTR-RC adaptive timeout
+	// may be used.
+	void readPhase(unsigned int *sensor_values, unsigned char emitterState,
+		unsigned char adaptive = 0);
+
+	unsigned char _calibrating;	// true while calibrate() is reading
 };
 
 
 
-// Object to be used for QTR-1RC and QTR-8RC sensors
-class PololuQTRSensorsRC : public PololuQTRSensors
+// The part of PololuQTRSensorsRC and PololuQTRSensorsRCStatic that they
+// have in common; they only differ in where the calibration arrays are
+// stored.  This class cannot be instantiated directly.
+class PololuQTRSensorsRCBase : public PololuQTRSensors
 {
 	// allows the base PololuQTRSensors class to access this class' 
 	// readPrivate()
 	friend class PololuQTRSensors;
 	
+  public:
+
+	// If enable is true, read() only records the time and the state of
+	// the sensor pins whenever one of them changes, and works out which
+	// sensors changed after the timing is done.  This keeps the timing
+	// loop short, which gives finer and more uniform timing resolution
+	// when many sensors (e.g. 8-16) discharge at nearly the same time.
+	// The reading also ends as soon as every sensor has discharged
+	// instead of always running until the timeout.  If more pin changes
+	// occur than the log can hold, the rest of the reading is done the
+	// usual way.  Disabled by default.
+	void setEdgeLogging(unsigned char enable);
+
+	// If enable is true, readings taken with QTR_EMITTERS_ON or
+	// QTR_EMITTERS_OFF after calibration stop waiting for a sensor once
+	// the time passes that sensor's calibrated maximum plus margin (in
+	// timer2 counts), and end as soon as no sensor is left to wait for.
+	// Sensors that had not discharged by then read as their calibrated
+	// maximum plus margin, not as the full timeout.  This does not change
+	// the values returned by readCalibrated() or readLine(), since any
+	// later time would be scaled to 1000 anyway, but on a dark surface it
+	// can end the reading long before the timeout.  With the continuous
+	// calibration (see setContinuousCalibration()), a sensor that is cut
+	// off raises its maximum by at most margin per reading, so a surface
+	// darker than any seen so far is learned over several readings
+	// instead of one sensor jumping to the full timeout.  This applies
+	// to edge-logging readings too.  calibrate() always uses the full
+	// timeout, and so does a sensor whose calibrated maximum is not above
+	// its minimum, e.g. after resetCalibration().  Disabled by default.
+	void setAdaptiveTimeout(unsigned char enable, unsigned int margin = 100);
+
+	// Reads several QTR-RC sensor arrays at the same time, so that it
+	// takes about as long as reading the slowest one instead of all of
+	// them in turn.  The sensors of all the arrays are charged together
+	// and timed in a single loop, and the readings of arrays[j] are
+	// stored in sensor_values[j], which must have space for as many
+	// values as that array has sensors.  Each array keeps its own timeout.
+	// readMode may be QTR_EMITTERS_ON or QTR_EMITTERS_OFF.  Example usage:
+	// PololuQTRSensorsRCBase *arrays[] = { &front, &rear };
+	// unsigned int *values[] = { front_values, rear_values };
+	// PololuQTRSensorsRCBase::readGroup(arrays, values, 2);
+	static void readGroup(PololuQTRSensorsRCBase **arrays, unsigned int **sensor_values,
+		unsigned char numArrays, unsigned char readMode = QTR_EMITTERS_ON);
+
+#ifndef ARDUINO
+	// The following methods read the sensors in the background, using
+	// pin-change interrupts stamped with the timer2 tick count instead
+	// of busy-polling the pins, so the CPU is free to do other work while
+	// the sensor capacitors discharge.  readStart() charges the sensors
+	// and returns immediately.  Then call readPoll() periodically: it
+	// returns 0 while the read is in progress, and once it returns
+	// non-zero the sensor_values array passed to readStart() holds the
+	// same values read() would have returned.  readComplete() waits for
+	// the read to finish.  readMode may be QTR_EMITTERS_ON or
+	// QTR_EMITTERS_OFF, and the emitters are switched and allowed to
+	// settle just as in read(); QTR_EMITTERS_ON_AND_OFF is not supported,
+	// and readStart() does nothing if it is given (readPoll() then returns
+	// 1 right away and sensor_values is left unchanged).  Only one
+	// background read can be in progress at a time, and you must not
+	// modify sensor_values until it is done.
+	// These methods define the PCINT0-PCINT3 interrupt vectors, which
+	// OrangutanPulseIn and PololuWheelEncoders also define, so a program
+	// that uses both will fail to link with a multiple-definition error.
+	void readStart(unsigned int *sensor_values, unsigned char readMode = QTR_EMITTERS_ON);
+	unsigned char readPoll();
+	void readComplete();
+
+	// Don't call this function.  It should only be called from the
+	// pin-change interrupt service routine defined in
+	// PololuQTRSensorsRCAsync.cpp, which needs access to private data.
+	void handlePinChange(unsigned long time);
+#endif
+
+  protected:
+
+	PololuQTRSensorsRCBase() { }
+
+	// See PololuQTRSensorsRC::init().
+	void init(unsigned char* pins, unsigned char numSensors,
+		  unsigned int timeout, unsigned char emitterPin);
+
+	unsigned char _bitmask[QTR_MAX_SENSORS];
+	// pointers to PIN registers
+	volatile unsigned char* _register[QTR_MAX_SENSORS];	// needs to be volatile
+
+  private:
+
+	// Reads the sensor values into an array. There *MUST* be space
+	// for as many values as there were sensors specified in the constructor.
+	// Example usage:
+	// unsigned int sensor_values[8];
+	// sensors.read(sensor_values);
+	// The values returned are a measure of the reflectance in timer2 counts,
+	// with higher values corresponding to lower reflectance (e.g. a black
+	// surface or a void).  Timer2 will be running at the MCU clock / 8, which
+	// means 2 MHz for a 16 MHz MCU and 2.5 MHz for a 20 MHz MCU.
+	// The sensors are charged for chargeTime microseconds (at least 10)
+	// before the timing starts, which lets read() overlap the charging
+	// with the emitter settle time.
+	// If calibratedMinimum and calibratedMaximum are not 0 and the
+	// adaptive timeout is enabled, they are used to end the reading early
+	// (see setAdaptiveTimeout()).
+	void readPrivate(unsigned int *sensor_values, unsigned int chargeTime = 10,
+		unsigned int *calibratedMinimum = 0, unsigned int *calibratedMaximum = 0);
+
+	// Does the timing for readPrivate() in edge-logging mode, starting
+	// from the given TCNT2 value, which is updated.  If limit is not 0, it
+	// holds each sensor's adaptive timeout.  Returns the number of timer2
+	// counts the timing has covered, or timeout if it is done.
+	unsigned int readEdgeLog(unsigned int *sensor_values, unsigned char *last_time,
+		unsigned int timeout, unsigned int *limit);
+
+	#ifdef _ORANGUTAN_XX4
+	unsigned char _portAMask;
+    #endif
+	unsigned char _portBMask;
+	unsigned char _portCMask;
+	unsigned char _portDMask;
+
+	unsigned char _edgeLogging;
+	unsigned char _adaptiveTimeout;
+	unsigned int _adaptiveTimeoutMargin;
+};
+
+
+
+// Object to be used for QTR-1RC and QTR-8RC sensors
+class PololuQTRSensorsRC : public PololuQTRSensorsRCBase
+{
   public:
   
 	// if this constructor is used, the user must call init() before using
@@ -219,11 +445,98 @@ class PololuQTRSensorsRC : public PololuQTRSensors
 	// QTR sensor arrays.  If a valid pin is specified,
 	// the emitters will only be turned on during a reading.  If an invalid
 	// pin is specified (e.g. 255), the IR emitters will always be on.
-	void init(unsigned char* pins, unsigned char numSensors, 
+	void init(unsigned char* pins, unsigned char numSensors,
 		  unsigned int timeout = 4000, unsigned char emitterPin = 255);
-		  
+};
+
+
+
+// Object to be used for QTR-1RC and QTR-8RC sensors that never calls
+// malloc().  It works like PololuQTRSensorsRC, including how the pins are
+// set up, but the calibration arrays and the scale tables of
+// readCalibrated() are sized for numSensors sensors and stored in the
+// object.  Example usage:
+// unsigned char pins[] = {14, 15, 16, 17, 18};
+// PololuQTRSensorsRCStatic<5> qtr(pins, 2000);
+template <unsigned char numSensors>
+class PololuQTRSensorsRCStatic : public PololuQTRSensorsRCBase
+{
+	// numSensors must be between 1 and QTR_MAX_SENSORS
+	typedef char numSensorsCheck[(numSensors > 0 && numSensors <= QTR_MAX_SENSORS) ? 1 : -1];
+
+  public:
+
+	// if this constructor is used, the user must call init() before using
+	// the methods in this class
+	PololuQTRSensorsRCStatic() { }
+
+	// this constructor just calls init()
+	PololuQTRSensorsRCStatic(unsigned char* pins, unsigned int timeout = 4000,
+		  unsigned char emitterPin = 255)
+	{
+		init(pins, timeout, emitterPin);
+	}
+
+	// See PololuQTRSensorsRC::init().  The 'pins' array must contain
+	// numSensors elements.
+	void init(unsigned char* pins, unsigned int timeout = 4000,
+		  unsigned char emitterPin = 255)
+	{
+		PololuQTRSensorsRCBase::init(pins, numSensors, timeout, emitterPin);
+		_calibrationStorage = _calibrationStorageArray;
+		_scaleStorage = _scaleStorageArray;
+	}
+
+  private:
+
+	unsigned int _calibrationStorageArray[4 * numSensors];
+	CalibrationScale _scaleStorageArray[3 * numSensors];
+};
+
+
+
+// The part of PololuQTRSensorsAnalog and PololuQTRSensorsAnalogStatic
+// that they have in common; they only differ in where the calibration
+// arrays are stored.  This class cannot be instantiated directly.
+class PololuQTRSensorsAnalogBase : public PololuQTRSensors
+{
+	// allows the base PololuQTRSensors class to access this class' 
+	// readPrivate()
+	friend class PololuQTRSensors;
+	
+  public:
+
+#ifndef ARDUINO
+	// The following methods make the ADC scan the sensors continuously in
+	// the background, driven by the ADC conversion-complete interrupt.
+	// Each sensor is sampled numSamplesPerSensor times per frame, and
+	// once scanStart() has been called, read(), readCalibrated(), and
+	// readLine() return immediately with the most recent complete frame
+	// instead of performing the conversions themselves.  scanStart()
+	// waits for the first frame to complete.  readMode may be
+	// QTR_EMITTERS_ON or QTR_EMITTERS_OFF; the emitters stay in that state
+	// until scanStop() is called, and the readMode argument of read()
+	// is ignored while scanning.  While a scan is running, the ADC must
+	// not be used for anything else (e.g. by OrangutanAnalog).
+	void scanStart(unsigned char readMode = QTR_EMITTERS_ON);
+	void scanStop();
+
+	// Don't call this function.  It should only be called from the ADC
+	// interrupt service routine defined in PololuQTRSensorsAnalogScan.cpp,
+	// which needs access to private data.
+	void handleConversion(unsigned int result);
+#endif
+
+  protected:
+
+	PololuQTRSensorsAnalogBase() { }
+
+	// See PololuQTRSensorsAnalog::init().
+	void init(unsigned char* analogPins, unsigned char numSensors,
+		unsigned char numSamplesPerSensor, unsigned char emitterPin);
+
+	unsigned char _analogPins[QTR_MAX_SENSORS];
 
-  
   private:
 
 	// Reads the sensor values into an array. There *MUST* be space
@@ -231,36 +544,28 @@ class PololuQTRSensorsRC : public PololuQTRSensors
 	// Example usage:
 	// unsigned int sensor_values[8];
 	// sensors.read(sensor_values);
-	// The values returned are a measure of the reflectance in timer2 counts,
-	// with higher values corresponding to lower reflectance (e.g. a black
-	// surface or a void).  Timer2 will be running at the MCU clock / 8, which
-	// means 2 MHz for a 16 MHz MCU and 2.5 MHz for a 20 MHz MCU.
+	// The values returned are a measure of the reflectance in terms of a
+	// 10-bit ADC average with higher values corresponding to lower 
+	// reflectance (e.g. a black surface or a void).
 	void readPrivate(unsigned int *sensor_values);
- 
 
-  private:
+	// Copies the most recent frame of a background scan into
+	// sensor_values.  Returns 0 if no scan is running.
+	unsigned char readScanFrame(unsigned int *sensor_values);
 
-	unsigned char _bitmask[QTR_MAX_SENSORS];
-	// pointer to PIN registers
-	volatile unsigned char* _register[QTR_MAX_SENSORS];	// needs to be volatile
+	unsigned char _numSamplesPerSensor;
+	unsigned char _portMask;
 
-	#ifdef _ORANGUTAN_XX4
-	unsigned char _portAMask;
-    #endif
-	unsigned char _portBMask;
-	unsigned char _portCMask;
-	unsigned char _portDMask;
+	// The sums of the samples of the last complete background scan frame,
+	// or 0 if no scan is running.
+	unsigned int * volatile _scanFrame;
 };
 
 
 
 // Object to be used for QTR-1A and QTR-8A sensors
-class PololuQTRSensorsAnalog : public PololuQTRSensors
+class PololuQTRSensorsAnalog : public PololuQTRSensorsAnalogBase
 {
-	// allows the base PololuQTRSensors class to access this class' 
-	// readPrivate()
-	friend class PololuQTRSensors;
-	
   public:
   
 	// if this constructor is used, the user must call init() before using
@@ -301,29 +606,50 @@ class PololuQTRSensorsAnalog : public PololuQTRSensors
 	// QTR sensor arrays.  If a valid pin is specified, the emitters will only
 	// be turned on during a reading.  If an invalid pin is specified 
 	// (e.g. 255), the IR emitters will always be on.
-	void init(unsigned char* analogPins, unsigned char numSensors, 
+	void init(unsigned char* analogPins, unsigned char numSensors,
 		unsigned char numSamplesPerSensor = 4, unsigned char emitterPin = 255);
-		  
+};
 
-  
-  private:
 
-	// Reads the sensor values into an array. There *MUST* be space
-	// for as many values as there were sensors specified in the constructor.
-	// Example usage:
-	// unsigned int sensor_values[8];
-	// sensors.read(sensor_values);
-	// The values returned are a measure of the reflectance in terms of a
-	// 10-bit ADC average with higher values corresponding to lower 
-	// reflectance (e.g. a black surface or a void).
-	void readPrivate(unsigned int *sensor_values);
- 
+
+// Object to be used for QTR-1A and QTR-8A sensors that never calls
+// malloc().  Like PololuQTRSensorsRCStatic, it stores the calibration
+// arrays and the scale tables in the object, sized for numSensors
+// sensors.
+template <unsigned char numSensors>
+class PololuQTRSensorsAnalogStatic : public PololuQTRSensorsAnalogBase
+{
+	// numSensors must be between 1 and QTR_MAX_SENSORS
+	typedef char numSensorsCheck[(numSensors > 0 && numSensors <= QTR_MAX_SENSORS) ? 1 : -1];
+
+  public:
+
+	// if this constructor is used, the user must call init() before using
+	// the methods in this class
+	PololuQTRSensorsAnalogStatic() { }
+
+	// this constructor just calls init()
+	PololuQTRSensorsAnalogStatic(unsigned char* analogPins,
+		unsigned char numSamplesPerSensor = 4, unsigned char emitterPin = 255)
+	{
+		init(analogPins, numSamplesPerSensor, emitterPin);
+	}
+
+	// See PololuQTRSensorsAnalog::init().  The 'analogPins' array must
+	// contain numSensors elements.
+	void init(unsigned char* analogPins, unsigned char numSamplesPerSensor = 4,
+		unsigned char emitterPin = 255)
+	{
+		PololuQTRSensorsAnalogBase::init(analogPins, numSensors,
+			numSamplesPerSensor, emitterPin);
+		_calibrationStorage = _calibrationStorageArray;
+		_scaleStorage = _scaleStorageArray;
+	}
 
   private:
 
-	unsigned char _analogPins[QTR_MAX_SENSORS];
-	unsigned char _numSamplesPerSensor;
-	unsigned char _portMask;
+	unsigned int _calibrationStorageArray[4 * numSensors];
+	CalibrationScale _scaleStorageArray[3 * numSensors];
 };
 
 extern "C" {
@@ -346,6 +672,19 @@ unsigned int *qtr_calibrated_minimum_on(void);
 unsigned int *qtr_calibrated_maximum_on(void);
 unsigned int *qtr_calibrated_minimum_off(void);
 unsigned int *qtr_calibrated_maximum_off(void);
+void qtr_set_emitter_settle_time(unsigned int microseconds);
+void qtr_set_emitter_pipelining(unsigned char enable);
+void qtr_set_continuous_calibration(unsigned char decayPeriod, unsigned int minimumSpan);
+void qtr_set_edge_logging(unsigned char enable);	// QTR-RC only
+void qtr_set_adaptive_timeout(unsigned char enable, unsigned int margin);	// QTR-RC only
+
+#ifndef ARDUINO
+void qtr_read_start(unsigned int *sensor_values, unsigned char readMode);
+unsigned char qtr_read_poll(void);
+void qtr_read_complete(void);
+void qtr_scan_start(unsigned char readMode);
+void qtr_scan_stop(void);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,199 @@
+/*
+  PololuQTRSensorsAnalogScan.cpp - Background scanning of QTR-1A and
+	QTR-8A sensors.  Instead of performing every conversion itself and
+	waiting for each one to finish like PololuQTRSensorsAnalog::read(),
+	the ADC conversion-complete interrupt walks through the sensor list
+	continuously, accumulating the samples into one of two frame buffers
+	while read() copies the most recent complete frame out of the other.
+
+	This code is in its own file so that the ADC interrupt, which is
+	shared with the other background ADC features through
+	OrangutanAnalog::setConversionHandler(), is only linked into programs
+	that use it.  It is not available for Arduino.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#ifndef ARDUINO
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "PololuQTRSensors.h"
+#include "../OrangutanAnalog/OrangutanAnalog.h"
+
+#ifdef _ORANGUTAN_XX4
+  #define ANALOG_PORT PORTA
+  #define ANALOG_DDR  DDRA
+#else
+  #define ANALOG_PORT PORTC
+  #define ANALOG_DDR  DDRC
+#endif
+
+PololuQTRSensors *qtr_c_object();
+
+// The object whose background scan is running, or 0 if there is none.
+static PololuQTRSensorsAnalogBase * volatile qtr_scan_active;
+
+// The ISR accumulates samples into qtr_scan_buffers[qtr_scan_back] while
+// the other buffer holds the last complete frame.
+static unsigned int qtr_scan_buffers[2][QTR_MAX_SENSORS];
+static unsigned char qtr_scan_back;
+
+// The sensor and sample that the conversion in progress belongs to.
+static unsigned char qtr_scan_sensor;
+static unsigned char qtr_scan_sample;
+
+// The state of the registers used by the scan, restored by scanStop().
+static unsigned char qtr_scan_admux;
+static unsigned char qtr_scan_adcsra;
+static unsigned char qtr_scan_ddr;
+static unsigned char qtr_scan_port;
+
+
+// The handler installed for the ADC interrupt while a scan is running.
+static void qtr_scan_conversion()
+{
+	if (qtr_scan_active)
+		qtr_scan_active->handleConversion(ADC);
+}
+
+
+extern "C" void qtr_scan_start(unsigned char readMode)
+{
+	((PololuQTRSensorsAnalogBase *)qtr_c_object())->scanStart(readMode);
+}
+
+extern "C" void qtr_scan_stop()
+{
+	((PololuQTRSensorsAnalogBase *)qtr_c_object())->scanStop();
+}
+
+
+// Adds a conversion result to the frame being accumulated and starts the
+// next conversion.  The sensors are sampled in the same order as
+// readPrivate() samples them.  This is called from the ADC ISR.
+void PololuQTRSensorsAnalogBase::handleConversion(unsigned int result)
+{
+	unsigned char i;
+	unsigned int *frame = qtr_scan_buffers[qtr_scan_back];
+
+	frame[qtr_scan_sensor] += result;
+
+	if (++qtr_scan_sensor >= _numSensors)
+	{
+		qtr_scan_sensor = 0;
+		if (++qtr_scan_sample >= _numSamplesPerSensor)
+		{
+			// the frame is complete, so publish it and start on the other one
+			qtr_scan_sample = 0;
+			_scanFrame = frame;
+			qtr_scan_back ^= 1;
+			frame = qtr_scan_buffers[qtr_scan_back];
+			for (i = 0; i < _numSensors; i++)
+				frame[i] = 0;
+		}
+	}
+
+	ADMUX = (1<<6) | _analogPins[qtr_scan_sensor];	// set analog input channel
+	ADCSRA |= 1 << ADSC;							// start the conversion
+}
+
+
+// Starts scanning the sensors in the background and waits for the first
+// frame to complete.
+void PololuQTRSensorsAnalogBase::scanStart(unsigned char readMode)
+{
+	unsigned char i;
+
+	// only one scan can use the ADC at a time
+	if (qtr_scan_active)
+		qtr_scan_active->scanStop();
+	OrangutanAnalog::stopScan();
+
+	if (readMode == QTR_EMITTERS_OFF)
+		emittersOff();
+	else
+		emittersOn();
+
+	// store current state of various registers
+	qtr_scan_admux = ADMUX;
+	qtr_scan_adcsra = ADCSRA;
+	qtr_scan_ddr = ANALOG_DDR;
+	qtr_scan_port = ANALOG_PORT;
+
+	// wait for any current conversion to finish
+	while (ADCSRA & (1 << ADSC));
+
+	// set all sensor pins to high-Z inputs
+	ANALOG_DDR &= ~_portMask;
+	ANALOG_PORT &= ~_portMask;
+
+	for (i = 0; i < _numSensors; i++)
+		qtr_scan_buffers[0][i] = qtr_scan_buffers[1][i] = 0;
+	qtr_scan_back = 0;
+	qtr_scan_sensor = 0;
+	qtr_scan_sample = 0;
+	_scanFrame = 0;
+	qtr_scan_active = this;
+	OrangutanAnalog::setConversionHandler(qtr_scan_conversion);
+
+	// configure the ADC as readPrivate() does, clear any stale
+	// conversion-complete flag, enable the interrupt, and start the first
+	// conversion
+	ADMUX = (1<<6) | _analogPins[0];
+	ADCSRA = OrangutanAnalog::getADCSRA() | (1 << ADIF) | (1 << ADIE);
+	sei();
+	ADCSRA |= 1 << ADSC;
+
+	// Wait for the first frame.  Polling ADCSRA also ends the wait if the
+	// ADC interrupt gets disabled, which would otherwise hang here.
+	while (_scanFrame == 0 && (ADCSRA & (1 << ADIE)));
+}
+
+
+// Stops the background scan, restores the ADC registers, and turns off the
+// emitters.
+void PololuQTRSensorsAnalogBase::scanStop()
+{
+	if (qtr_scan_active != this)
+		return;
+
+	ADCSRA &= ~(1 << ADIE);
+	while (ADCSRA & (1 << ADSC));	// let the last conversion finish
+
+	qtr_scan_active = 0;
+	_scanFrame = 0;
+	OrangutanAnalog::setConversionHandler(0);
+
+	ADMUX = qtr_scan_admux;
+	ADCSRA = qtr_scan_adcsra | (1 << ADIF);	// also clears the stale flag
+	ANALOG_PORT = qtr_scan_port;
+	ANALOG_DDR = qtr_scan_ddr;
+
+	emittersOff();
+}
+
+#endif // ARDUINO
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
@@ -0,0 +1,251 @@
+/*
+  PololuQTRSensorsRCAsync.cpp - Interrupt-driven, non-blocking reading of
+	QTR-1RC and QTR-8RC sensors.  Instead of busy-polling the sensor pins
+	like PololuQTRSensorsRC::read(), these functions charge the sensors
+	and then let pin-change interrupts record the time at which each
+	sensor discharges, so the CPU is free while the read is in progress.
+
+	This code is in its own file so that its pin-change ISRs are only
+	linked into programs that use it.  It is not available for Arduino.
+*/
+
+/*
+ * Copyright (c) 2008-2012 Pololu Corporation. For more information, see
+ *
+ *   http://www.pololu.com
+ *   http://forum.pololu.com
+ *   http://www.pololu.com/docs/0J18
+ *
+ * You may freely modify and share this code, as long as you keep this
+ * notice intact (including the two links above).  Licensed under the
+ * Creative Commons BY-SA 3.0 license:
+ *
+ *   http://creativecommons.org/licenses/by-sa/3.0/
+ *
+ * Disclaimer: To the extent permitted by law, Pololu provides this work
+ * without any warranty.  It might be defective, in which case you agree
+ * to be responsible for all resulting costs and damages.
+ */
+
+#ifndef ARDUINO
+
+#ifndef F_CPU
+#define F_CPU 20000000UL
+#endif
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "PololuQTRSensors.h"
+#include "../OrangutanTime/OrangutanTime.h"
+
+extern volatile unsigned long tickCount;
+
+PololuQTRSensors *qtr_c_object();
+
+// The object whose background read is in progress, or 0 if there is none.
+static PololuQTRSensorsRCBase * volatile qtr_rc_active;
+
+// Where the sensor readings of the current background read go.
+static unsigned int *qtr_rc_values;
+
+// One bit for each sensor that has not discharged yet.  The ISR only
+// ever clears bits, so the main loop can safely read this without
+// disabling interrupts.
+static volatile unsigned int qtr_rc_pending;
+
+// The tick count at which the sensor lines were released.
+static unsigned long qtr_rc_start_time;
+
+
+ISR(PCINT0_vect)
+{
+	// the following is copied from OrangutanTime::ticks() since this is faster than calling
+	// the ticks() method:
+	unsigned long time = TCNT2 | tickCount;
+	if (TIFR2 & (1 << TOV2))	// if TCNT2 has overflowed since we disabled t2 ovf interrupt
+	{
+		// NOTE: it is important to perform this computation again.  See OrangutanTime::ticks().
+		time = TCNT2 | (tickCount + 256);		// compute ticks again and add 256 for the overflow
+	}
+
+	if (qtr_rc_active)
+		qtr_rc_active->handlePinChange(time);
+}
+
+ISR(PCINT1_vect,ISR_ALIASOF(PCINT0_vect));
+ISR(PCINT2_vect,ISR_ALIASOF(PCINT0_vect));
+#ifdef PCINT3_vect  // this ISR only available on the Orangutan SVP and X2
+ISR(PCINT3_vect,ISR_ALIASOF(PCINT0_vect));
+#endif
+
+
+extern "C" void qtr_read_start(unsigned int *sensor_values, unsigned char readMode)
+{
+	((PololuQTRSensorsRCBase *)qtr_c_object())->readStart(sensor_values, readMode);
+}
+
+extern "C" unsigned char qtr_read_poll()
+{
+	return ((PololuQTRSensorsRCBase *)qtr_c_object())->readPoll();
+}
+
+extern "C" void qtr_read_complete()
+{
+	((PololuQTRSensorsRCBase *)qtr_c_object())->readComplete();
+}
+
+
+// Records the discharge time of every sensor that has gone low since the
+// last call.  This is called from the pin-change ISR.
+void PololuQTRSensorsRCBase::handlePinChange(unsigned long time)
+{
+	unsigned char i;
+	unsigned int pending = qtr_rc_pending;
+	unsigned long elapsed = time - qtr_rc_start_time;
+
+	if (elapsed > _maxValue)
+		elapsed = _maxValue;
+
+	for (i = 0; i < _numSensors; i++)
+	{
+		unsigned int bit = 1 << i;
+		if ((pending & bit) && !(*_register[i] & _bitmask[i]))
+		{
+			qtr_rc_values[i] = elapsed;
+			pending &= ~bit;
+		}
+	}
+
+	qtr_rc_pending = pending;
+}
+
+
+// Charges the sensors and starts timing their discharge in the background.
+void PololuQTRSensorsRCBase::readStart(unsigned int *sensor_values, unsigned char readMode)
+{
+	// finish any read that is still in progress
+	if (qtr_rc_active)
+		qtr_rc_active->readComplete();
+
+	// a single background read can not cover both emitter states
+	if (readMode != QTR_EMITTERS_ON && readMode != QTR_EMITTERS_OFF)
+		return;
+
+	// like read(), turn the emitters on or off and wait for them to settle
+	unsigned int settleTime = setEmitters(readMode);
+
+	// set all sensor pins to outputs and drive them high for at least
+	// 10 us, letting the emitters settle at the same time
+	#ifdef _ORANGUTAN_XX4
+	DDRA |= _portAMask;
+	PORTA |= _portAMask;
+	#endif
+	DDRB |= _portBMask;
+	PORTB |= _portBMask;
+	DDRC |= _portCMask;
+	PORTC |= _portCMask;
+	DDRD |= _portDMask;
+	PORTD |= _portDMask;
+
+	delayMicroseconds(settleTime > 10 ? settleTime : 10);
+
+	qtr_rc_values = sensor_values;
+	qtr_rc_pending = (unsigned int)((1UL << _numSensors) - 1);
+	qtr_rc_active = this;
+
+	// set all sensor pins to inputs and turn off the pull-ups
+	#ifdef _ORANGUTAN_XX4
+	DDRA &= ~_portAMask;
+	PORTA &= ~_portAMask;
+	#endif
+	DDRB &= ~_portBMask;
+	PORTB &= ~_portBMask;
+	DDRC &= ~_portCMask;
+	PORTC &= ~_portCMask;
+	DDRD &= ~_portDMask;
+	PORTD &= ~_portDMask;
+
+	// This also makes sure timer2 is running at 2.5 MHz and that tickCount
+	// is being updated.
+	qtr_rc_start_time = OrangutanTime::ticks();
+
+	// enable the pin-change interrupts for the sensor pins
+	cli();
+	#ifdef _ORANGUTAN_XX4
+	PCMSK0 |= _portAMask;
+	PCMSK1 |= _portBMask;
+	PCMSK2 |= _portCMask;
+	PCMSK3 |= _portDMask;
+	PCIFR = 0x0F;
+	PCICR |= (_portAMask ? 1 << PCIE0 : 0) | (_portBMask ? 1 << PCIE1 : 0) |
+		(_portCMask ? 1 << PCIE2 : 0) | (_portDMask ? 1 << PCIE3 : 0);
+	#else
+	PCMSK0 |= _portBMask;
+	PCMSK1 |= _portCMask;
+	PCMSK2 |= _portDMask;
+	PCIFR = 0x07;
+	PCICR |= (_portBMask ? 1 << PCIE0 : 0) | (_portCMask ? 1 << PCIE1 : 0) |
+		(_portDMask ? 1 << PCIE2 : 0);
+	#endif
+
+	// catch any sensors that discharged before the interrupts were enabled
+	handlePinChange(OrangutanTime::ticks());
+	sei();
+}
+
+
+// Returns 0 while the background read is in progress.  Once every sensor
+// has discharged or the timeout has elapsed, this finishes the read and
+// returns 1.
+unsigned char PololuQTRSensorsRCBase::readPoll()
+{
+	unsigned char i;
+
+	if (qtr_rc_active != this)
+		return 1;	// no read in progress
+
+	if (qtr_rc_pending && OrangutanTime::ticks() - qtr_rc_start_time < _maxValue)
+		return 0;
+
+	// disable the pin-change interrupts for the sensor pins
+	#ifdef _ORANGUTAN_XX4
+	PCMSK0 &= ~_portAMask;
+	PCMSK1 &= ~_portBMask;
+	PCMSK2 &= ~_portCMask;
+	PCMSK3 &= ~_portDMask;
+	if (!PCMSK3) PCICR &= ~(1 << PCIE3);
+	#else
+	PCMSK0 &= ~_portBMask;
+	PCMSK1 &= ~_portCMask;
+	PCMSK2 &= ~_portDMask;
+	#endif
+	if (!PCMSK0) PCICR &= ~(1 << PCIE0);
+	if (!PCMSK1) PCICR &= ~(1 << PCIE1);
+	if (!PCMSK2) PCICR &= ~(1 << PCIE2);
+
+	qtr_rc_active = 0;
+
+	// sensors that never discharged are considered completely black
+	for (i = 0; i < _numSensors; i++)
+		if (qtr_rc_pending & (1 << i))
+			qtr_rc_values[i] = _maxValue;
+
+	emittersOffNoWait();
+
+	return 1;
+}
+
+
+// Waits for the background read to finish.
+void PololuQTRSensorsRCBase::readComplete()
+{
+	while (!readPoll());
+}
+
+#endif // ARDUINO
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **
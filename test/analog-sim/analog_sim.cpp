@@ -0,0 +1,630 @@
+/*
+  analog_sim.cpp - Runs OrangutanAnalog on a PC against a simulated ADC,
+	to check that the noise reduction mode (setNoiseReduction()), in which
+	entering sleep starts each conversion, returns exactly the same
+	results as setting ADSC and polling isConverting(), and to compare
+	what each sample costs.  It checks that in noise reduction mode every
+	conversion is started by the sleep and none by ADSC, since a
+	conversion started before the CPU halts picks up its noise, unless
+	OrangutanTime's timer2 overflow interrupt is enabled, in which case
+	no conversion may be started by sleeping.  It also checks the oversampled 11-bit and 12-bit modes with
+	readAverage() and with the background scan, compares the
+	fixed-point toMillivolts() with the exact, rounded quotient, and
+	checks that timed sampling (startTimedSampling()) delivers samples
+	exactly the requested number of timer0 overflows apart.
+
+	Each channel has a fixed input voltage, and every conversion adds a
+	small deterministic dither that depends on how many conversions have
+	been done, so a lost or repeated conversion changes the results.  A
+	conversion takes 13 ADC clocks (25 for the first one after the ADC is
+	enabled) at 20 MHz divided by the prescaler in ADCSRA.  As on the AVR,
+	entering ADC noise reduction sleep with the ADC enabled and idle
+	starts a conversion.  Timer0 runs
+	at 2.5 MHz once it is started, and while auto-triggering is enabled
+	each overflow starts a conversion if the overflow flag was clear and
+	the ADC is idle.  OrangutanTime's ticks are taken from the same
+	simulated clock, and interrupts are taken with no latency.  For each
+	combination of noise reduction and clock profile this prints:
+
+	  us/sample     simulated time per sample of readAverage()
+	  polls/sample  reads of ADCSRA, i.e. iterations of the busy-wait loop
+	                during which the CPU is running
+	  wakes/sample  ADC interrupts taken
+	  host ns       PC time per sample, which includes the simulation
+
+	The program exits with a non-zero status if any check fails.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "avr/io.h"
+#include "avr/sleep.h"
+#include "../../src/OrangutanAnalog/OrangutanAnalog.h"
+#include "../../src/OrangutanTime/OrangutanTime.h"
+
+volatile unsigned char ADMUX;
+volatile unsigned int ADC;
+volatile unsigned char ADCH;
+volatile unsigned char ADCSRB;
+volatile unsigned char TCCR0A, TCCR0B;
+volatile unsigned char TCCR2A, TCCR2B, TIFR2, TIMSK2;
+volatile unsigned char SREG;
+volatile unsigned long tickCount;
+
+static volatile unsigned char adcsra;
+static unsigned char tifr0;
+static volatile unsigned char tifr0_written;
+
+extern "C" void ADC_vect(void);
+
+// The simulated clock, in units of 0.05 us (one CPU cycle at 20 MHz).
+static unsigned long sim_cycles;
+static unsigned long sim_polls;
+static unsigned long sim_wakes;
+static unsigned long sim_conversions;
+
+// The conversions started by setting ADSC and by entering sleep.
+static unsigned long sim_adsc_starts;
+static unsigned long sim_sleep_starts;
+
+unsigned char sim_sleep_mode;
+
+// When the conversion in progress finishes, or 0 if there is none.
+static unsigned long conversion_end;
+static unsigned char adc_was_enabled;
+
+// When timer0 next overflows, or 0 if it has not been started.
+static unsigned long timer0_overflow;
+
+#define CYCLES_PER_POLL 5
+#define CYCLES_PER_TICK 8
+#define CYCLES_PER_TIMER0_OVERFLOW (256 * CYCLES_PER_TICK)
+
+static const int dither[7] = { 0, 2, -1, 3, -3, 1, -2 };
+
+static unsigned int input(unsigned char channel)
+{
+	return 100 + 97 * (channel & 7);
+}
+
+// Clears the TIFR0 flags that have been written as ones.
+static void applyTifr0Write()
+{
+	tifr0 &= ~tifr0_written;
+	tifr0_written = 0;
+}
+
+// Sets the timer0 overflow flag, and auto-triggers a conversion if the
+// flag was clear.
+static void overflowTimer0()
+{
+	unsigned long time = timer0_overflow;
+	timer0_overflow += CYCLES_PER_TIMER0_OVERFLOW;
+	if (tifr0 & (1 << TOV0))
+		return;
+	tifr0 |= 1 << TOV0;
+
+	if ((adcsra & (1 << 7)) && (adcsra & (1 << ADATE)) && (ADCSRB & 7) == 4 && !conversion_end)
+	{
+		adcsra |= 1 << ADSC;
+		conversion_end = time + 13 * (1UL << (adcsra & 7));
+	}
+}
+
+// Finishes the conversion in progress, taking the ADC interrupt if it is
+// enabled.  The interrupt runs at the time the conversion finished.
+static void finishConversion()
+{
+	unsigned long end = conversion_end;
+	int value = input(ADMUX & 0x1F) + dither[sim_conversions++ % 7];
+	if (value < 0) value = 0;
+	if (value > 1023) value = 1023;
+	if (ADMUX & (1 << ADLAR))
+	{
+		ADC = value << 6;
+		ADCH = value >> 2;
+	}
+	else
+	{
+		ADC = value;
+		ADCH = value >> 8;
+	}
+	conversion_end = 0;
+	adcsra = (adcsra & ~(1 << ADSC)) | (1 << ADIF);
+
+	if (adcsra & (1 << ADIE))
+	{
+		unsigned long now = sim_cycles;
+		sim_cycles = end;
+		adcsra &= ~(1 << ADIF);
+		sim_wakes++;
+		ADC_vect();
+		applyTifr0Write();
+		if (sim_cycles < now)
+			sim_cycles = now;
+	}
+}
+
+// Starts a conversion now.
+static void startConversion()
+{
+	unsigned char clocks = adc_was_enabled ? 13 : 25;
+	conversion_end = sim_cycles + clocks * (1UL << (adcsra & 7));
+	adc_was_enabled = 1;
+	adcsra |= 1 << ADSC;
+}
+
+// Starts a conversion if ADSC has been set since the last access, and
+// handles the timer0 overflows and finished conversions that are due, in
+// the order they happen.
+static void update()
+{
+	if ((adcsra & (1 << ADSC)) && !conversion_end)
+	{
+		startConversion();
+		sim_adsc_starts++;
+	}
+	if (!(adcsra & (1 << 7)))
+		adc_was_enabled = 0;
+
+	if ((TCCR0B & 7) && !timer0_overflow)
+		timer0_overflow = sim_cycles + CYCLES_PER_TIMER0_OVERFLOW;
+
+	applyTifr0Write();
+	while (1)
+	{
+		if (timer0_overflow && timer0_overflow <= sim_cycles &&
+			(!conversion_end || timer0_overflow < conversion_end))
+			overflowTimer0();
+		else if (conversion_end && sim_cycles >= conversion_end)
+			finishConversion();
+		else
+			break;
+	}
+}
+
+extern "C" volatile unsigned char *sim_adcsra()
+{
+	sim_cycles += CYCLES_PER_POLL;
+	sim_polls++;
+	update();
+	return &adcsra;
+}
+
+extern "C" volatile unsigned char *sim_tifr0()
+{
+	return &tifr0_written;
+}
+
+// Returns TCNT2 and updates the rest of the tick count, for reading the
+// tick count in an interrupt as OrangutanTime::ticks() does.
+extern "C" volatile unsigned char *sim_tcnt2()
+{
+	static volatile unsigned char tcnt2;
+	unsigned long ticks = sim_cycles / CYCLES_PER_TICK;
+	tickCount = ticks & ~0xFFUL;
+	tcnt2 = ticks & 0xFF;
+	return &tcnt2;
+}
+
+unsigned long OrangutanTime::ticks()
+{
+	return sim_cycles / CYCLES_PER_TICK;
+}
+
+// Sleeps until the conversion in progress finishes.  Entering ADC noise
+// reduction mode with the ADC enabled and idle starts a conversion.
+void sim_sleep()
+{
+	update();
+	if (sim_sleep_mode == SLEEP_MODE_ADC && (adcsra & (1 << 7)) && !conversion_end)
+	{
+		startConversion();
+		sim_sleep_starts++;
+	}
+	if (conversion_end && sim_cycles < conversion_end)
+		sim_cycles = conversion_end;
+	update();
+}
+
+static double hostNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Takes the same set of readings with the given noise reduction setting,
+// starting from the same point in the dither sequence.  Returns the
+// number of readings, and counts a failure if a conversion was started
+// the wrong way: by ADSC in noise reduction mode, or by sleeping when
+// polling.
+static unsigned int takeReadings(unsigned char noiseReduction, unsigned int *results,
+	unsigned int *failures)
+{
+	static const unsigned int samples[] = { 1, 10, 64, 100 };
+	static const unsigned char modes[] = { MODE_10_BIT, MODE_8_BIT, MODE_11_BIT, MODE_12_BIT };
+	unsigned char channel, mode, i;
+	unsigned int n = 0;
+
+	OrangutanAnalog::setNoiseReduction(noiseReduction);
+	sim_conversions = 0;
+	sim_adsc_starts = 0;
+	sim_sleep_starts = 0;
+	for (mode = 0; mode < 4; mode++)
+	{
+		OrangutanAnalog::setMode(modes[mode]);
+		for (channel = 0; channel < 8; channel++)
+		{
+			results[n++] = OrangutanAnalog::read(channel);
+			results[n++] = OrangutanAnalog::readMillivolts(channel);
+			for (i = 0; i < sizeof(samples) / sizeof(samples[0]); i++)
+				results[n++] = OrangutanAnalog::readAverage(channel, samples[i]);
+		}
+	}
+	OrangutanAnalog::setMode(MODE_10_BIT);
+	OrangutanAnalog::setNoiseReduction(0);
+
+	unsigned long expected = noiseReduction ? sim_sleep_starts : sim_adsc_starts;
+	printf("%s: %lu conversions, %lu started by ADSC, %lu started by sleeping\n",
+		noiseReduction ? "noise reduction" : "polling", sim_conversions,
+		sim_adsc_starts, sim_sleep_starts);
+	if (expected != sim_conversions || sim_adsc_starts + sim_sleep_starts != sim_conversions)
+	{
+		printf("conversions were started the wrong way\n");
+		(*failures)++;
+	}
+	return n;
+}
+
+// Reads with noise reduction on while OrangutanTime's timer2 overflow
+// interrupt is enabled.  The sleep would stop timer2, so every conversion
+// must be started by ADSC instead, and the results must be the same as
+// when polling.  Returns the number of failures.
+static unsigned int checkTimer2Running()
+{
+	unsigned int polled[8], slept[8];
+	unsigned char channel, noiseReduction;
+	unsigned int failures = 0;
+
+	TIMSK2 = 1 << TOIE2;
+	for (noiseReduction = 0; noiseReduction < 2; noiseReduction++)
+	{
+		OrangutanAnalog::setNoiseReduction(noiseReduction);
+		sim_conversions = 0;
+		sim_adsc_starts = 0;
+		sim_sleep_starts = 0;
+		for (channel = 0; channel < 8; channel++)
+			(noiseReduction ? slept : polled)[channel] = OrangutanAnalog::read(channel);
+	}
+	OrangutanAnalog::setNoiseReduction(0);
+	TIMSK2 = 0;
+
+	printf("noise reduction with OrangutanTime running: %lu started by ADSC, %lu by sleeping\n",
+		sim_adsc_starts, sim_sleep_starts);
+	if (sim_sleep_starts != 0 || sim_adsc_starts != sim_conversions)
+	{
+		printf("conversions were started the wrong way\n");
+		failures++;
+	}
+	for (channel = 0; channel < 8; channel++)
+	{
+		if (polled[channel] != slept[channel])
+		{
+			printf("channel %u: %u polling, %u with noise reduction\n",
+				channel, polled[channel], slept[channel]);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+// Checks that oversampling gives the extra resolution.  Averaging a
+// multiple of 7 samples cancels the dither, so the results are exact.
+// Returns the number of failures.
+static unsigned int checkOversampling()
+{
+	static const unsigned char modes[] = { MODE_10_BIT, MODE_11_BIT, MODE_12_BIT };
+	unsigned int failures = 0;
+	unsigned char i, channel;
+
+	for (i = 0; i < 3; i++)
+	{
+		OrangutanAnalog::setMode(modes[i]);
+		for (channel = 0; channel < 8; channel++)
+		{
+			unsigned int expected = input(channel) << i;
+			unsigned int result = OrangutanAnalog::readAverage(channel, 7);
+			if (result != expected)
+			{
+				printf("mode %u channel %u: readAverage() returned %u, expected %u\n",
+					modes[i], channel, result, expected);
+				failures++;
+			}
+		}
+
+		// the same channels sampled by a one-pass background scan
+		AnalogScanEntry entries[8];
+		for (channel = 0; channel < 8; channel++)
+		{
+			entries[channel].channel = channel;
+			entries[channel].samples = 7;
+			entries[channel].updated = 0;
+		}
+		OrangutanAnalog::startScan(entries, 8, 0);
+		while (OrangutanAnalog::isScanning())
+			OrangutanAnalog::isConverting();	// lets simulated time pass
+		for (channel = 0; channel < 8; channel++)
+		{
+			unsigned int expected = input(channel) << i;
+			if (!entries[channel].updated || entries[channel].result != expected)
+			{
+				printf("mode %u channel %u: scan returned %u, expected %u\n",
+					modes[i], channel, entries[channel].result, expected);
+				failures++;
+			}
+		}
+
+		// an entry with no samples would divide by zero in the interrupt,
+		// so the whole list is rejected
+		entries[3].samples = 0;
+		entries[3].updated = 0;
+		OrangutanAnalog::startScan(entries, 8, 0);
+		if (OrangutanAnalog::isScanning() || entries[3].updated)
+		{
+			printf("mode %u: a scan entry with 0 samples was not rejected\n", modes[i]);
+			failures++;
+			OrangutanAnalog::stopScan();
+		}
+
+		unsigned int millivolts = OrangutanAnalog::toMillivolts(1023 << i);
+		if (millivolts != 5000)
+		{
+			printf("mode %u: full scale is %u mV, expected 5000\n", modes[i], millivolts);
+			failures++;
+		}
+	}
+	OrangutanAnalog::setMode(MODE_10_BIT);
+
+	printf("%u oversampling checks failed\n\n", failures);
+	return failures;
+}
+
+// Checks toMillivolts() against the exact rounded quotient for every
+// result in every mode and several calibrations.  The fixed-point scale
+// factors may round the other way when the quotient is very close to
+// one half, so a difference of 1 mV is allowed; the values used by the
+// hardware tests must be exact.  Returns the number of failures.
+static unsigned int checkMillivolts()
+{
+	static const unsigned char modes[] = { MODE_8_BIT, MODE_10_BIT, MODE_11_BIT, MODE_12_BIT };
+	static const unsigned int fullScales[] = { 255, 1023, 2046, 4092 };
+	static const unsigned int calibrations[] = { 5000, 4750, 5333, 3300 };
+	static const unsigned int exact[][2] = {
+		{ 255, 5000 }, { 127, 2490 }, { 1023, 5000 }, { 511, 2498 },
+		{ 2046, 5000 }, { 4092, 5000 }, { 2046, 2500 }, { 0, 0 } };
+	static const unsigned char exactModes[] = { 0, 0, 1, 1, 2, 3, 3, 3 };
+	unsigned int failures = 0;
+	unsigned long differences = 0, compared = 0;
+	unsigned char c, i;
+
+	for (c = 0; c < 4; c++)
+	{
+		OrangutanAnalog::setMillivoltCalibration(calibrations[c]);
+		for (i = 0; i < 4; i++)
+		{
+			OrangutanAnalog::setMode(modes[i]);
+			unsigned int scale = fullScales[i];
+			for (unsigned int result = 0; result <= scale; result++)
+			{
+				unsigned long product = (unsigned long)result * calibrations[c];
+				unsigned int expected = (product + scale / 2) / scale;
+				unsigned int millivolts = OrangutanAnalog::toMillivolts(result);
+				compared++;
+				if (millivolts == expected)
+					continue;
+				differences++;
+				if (millivolts + 1 != expected && millivolts != expected + 1)
+				{
+					printf("calibration %u mode %u: %u is %u mV, expected %u\n",
+						calibrations[c], modes[i], result, millivolts, expected);
+					failures++;
+				}
+			}
+		}
+	}
+
+	OrangutanAnalog::setMillivoltCalibration(5000);
+	for (i = 0; i < sizeof(exactModes); i++)
+	{
+		OrangutanAnalog::setMode(modes[exactModes[i]]);
+		unsigned int millivolts = OrangutanAnalog::toMillivolts(exact[i][0]);
+		if (millivolts != exact[i][1])
+		{
+			printf("mode %u: %u is %u mV, expected %u\n",
+				modes[exactModes[i]], exact[i][0], millivolts, exact[i][1]);
+			failures++;
+		}
+	}
+	OrangutanAnalog::setMode(MODE_10_BIT);
+
+	printf("%lu conversions to millivolts compared, %lu differ by 1 mV, %u checks failed\n\n",
+		compared, differences, failures);
+	return failures;
+}
+
+// Lets simulated time pass for at least the given number of timer0
+// overflows.
+static void waitOverflows(unsigned int overflows)
+{
+	unsigned long end = sim_cycles + (unsigned long)overflows * CYCLES_PER_TIMER0_OVERFLOW;
+	while (sim_cycles < end)
+		OrangutanAnalog::isConverting();
+}
+
+// Checks that timed sampling takes the channels in turn, with samples
+// exactly period timer0 overflows apart, and that it drops and counts
+// samples when the buffer is full.  Returns the number of failures.
+static unsigned int checkTimedSampling()
+{
+	static const unsigned char channels[] = { 2, 5, 7 };
+	static const unsigned char periods[] = { 1, 3, 10 };
+	static const unsigned char modes[] = { MODE_10_BIT, MODE_8_BIT, MODE_12_BIT };
+	static const unsigned char shifts[] = { 0, 2, 0 };	// right shifts to 10 bits
+	static const unsigned char extra[] = { 0, 0, 2 };	// left shifts from 10 bits
+	AnalogSample buffer[16], sample;
+	unsigned int failures = 0, checked = 0;
+	unsigned char i;
+
+	for (i = 0; i < 3; i++)
+	{
+		unsigned int n = 0;
+		unsigned long previous = 0;
+
+		OrangutanAnalog::setMode(modes[i]);
+		OrangutanAnalog::startTimedSampling(channels, 3, periods[i], buffer, 16);
+		unsigned long deadline = sim_cycles + 62UL * periods[i] * CYCLES_PER_TIMER0_OVERFLOW;
+		while (n < 60 && sim_cycles < deadline)
+		{
+			if (!OrangutanAnalog::readTimedSample(&sample))
+			{
+				OrangutanAnalog::isConverting();	// lets simulated time pass
+				continue;
+			}
+
+			unsigned char channel = channels[n % 3];
+			int expected = input(channel) >> shifts[i];
+			int difference = (int)(sample.value >> extra[i]) - expected;
+			if (sample.channel != channel || difference < -3 || difference > 3)
+			{
+				printf("mode %u sample %u: channel %u value %u, expected channel %u value %d\n",
+					modes[i], n, sample.channel, sample.value, channel, expected << extra[i]);
+				failures++;
+			}
+			if (n > 0 && sample.ticks - previous != periods[i] * 256UL)
+			{
+				printf("period %u sample %u: %lu ticks after the previous one\n",
+					periods[i], n, sample.ticks - previous);
+				failures++;
+			}
+			previous = sample.ticks;
+			n++;
+		}
+		if (n < 60)
+		{
+			printf("period %u: only %u samples arrived\n", periods[i], n);
+			failures++;
+		}
+		if (OrangutanAnalog::timedSamplesLost() != 0)
+		{
+			printf("period %u: %u samples lost\n", periods[i], OrangutanAnalog::timedSamplesLost());
+			failures++;
+		}
+		checked += n;
+	}
+
+	// let a small buffer overflow: it holds 3 samples and the rest are lost
+	OrangutanAnalog::setMode(MODE_10_BIT);
+	OrangutanAnalog::startTimedSampling(channels, 3, 1, buffer, 4);
+	waitOverflows(20);
+	unsigned int lost = OrangutanAnalog::timedSamplesLost();
+	if (OrangutanAnalog::timedSamplesAvailable() != 3 || lost < 16 || lost > 17)
+	{
+		printf("full buffer: %u samples available and %u lost, expected 3 and 16 or 17\n",
+			OrangutanAnalog::timedSamplesAvailable(), lost);
+		failures++;
+	}
+
+	// after stopping, no more conversions are triggered, and the samples in
+	// the buffer can still be read
+	OrangutanAnalog::stopTimedSampling();
+	unsigned long conversions = sim_conversions;
+	waitOverflows(5);
+	if (OrangutanAnalog::isTimedSampling() || sim_conversions != conversions)
+	{
+		printf("timed sampling did not stop\n");
+		failures++;
+	}
+	for (i = 0; OrangutanAnalog::readTimedSample(&sample); i++)
+	{
+		if (sample.channel != channels[i % 3])
+		{
+			printf("buffered sample %u is from channel %u, expected %u\n", i, sample.channel, channels[i % 3]);
+			failures++;
+		}
+	}
+	if (i != 3)
+	{
+		printf("%u buffered samples read after stopping, expected 3\n", i);
+		failures++;
+	}
+
+	printf("%u timed samples checked, %u checks failed\n\n", checked, failures);
+	return failures;
+}
+
+static void measure(unsigned char noiseReduction, unsigned char profile)
+{
+	static const char *profiles[] = { "accurate", "balanced", "fast" };
+
+	const unsigned int samples = 100;
+	const unsigned int repeats = 20;
+	unsigned int i;
+
+	OrangutanAnalog::setNoiseReduction(noiseReduction);
+	OrangutanAnalog::setProfile(profile);
+	unsigned long startCycles = sim_cycles;
+	unsigned long startPolls = sim_polls;
+	unsigned long startWakes = sim_wakes;
+	double startHost = hostNanoseconds();
+	for (i = 0; i < repeats; i++)
+		OrangutanAnalog::readAverage(3, samples);
+	double host = hostNanoseconds() - startHost;
+
+	// readAverage() also does one discarded conversion
+	double total = (double)repeats * (samples + 1);
+	printf("%-16s %-9s %9.1f %12.1f %12.2f %9.0f\n",
+		noiseReduction ? "noise reduction" : "polling", profiles[profile],
+		(sim_cycles - startCycles) * 0.05 / total,
+		(sim_polls - startPolls) / total,
+		(sim_wakes - startWakes) / total,
+		host / total);
+}
+
+int main()
+{
+	static unsigned int polled[200], slept[200];
+	unsigned int i, n, mismatches = 0, failures = 0;
+
+	n = takeReadings(0, polled, &failures);
+	takeReadings(1, slept, &failures);
+	for (i = 0; i < n; i++)
+	{
+		if (polled[i] != slept[i])
+		{
+			printf("reading %u differs: %u polling, %u with noise reduction\n",
+				i, polled[i], slept[i]);
+			mismatches++;
+		}
+	}
+	printf("%u readings compared, %u differ\n", i, mismatches);
+	failures += checkTimer2Running();
+	printf("\n");
+
+	failures += checkOversampling();
+	failures += checkMillivolts();
+	failures += checkTimedSampling();
+
+	printf("%-16s %-9s %9s %12s %12s %9s\n", "mode", "profile", "us/sample",
+		"polls/sample", "wakes/sample", "host ns");
+	for (i = 0; i < 2; i++)
+	{
+		measure(i, ADC_PROFILE_ACCURATE);
+		measure(i, ADC_PROFILE_BALANCED);
+		measure(i, ADC_PROFILE_FAST);
+	}
+	OrangutanAnalog::setNoiseReduction(0);
+	OrangutanAnalog::setProfile(ADC_PROFILE_ACCURATE);
+
+	return (mismatches || failures) ? 1 : 0;
+}
@@ -0,0 +1,21 @@
+/*
+  avr/sleep.h - Entering ADC noise reduction sleep starts a conversion if
+	the simulated ADC is enabled and idle, and sleeping lets the
+	conversion in progress finish and deliver its interrupt.  See
+	analog_sim.cpp.
+*/
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_ADC 1
+
+extern unsigned char sim_sleep_mode;
+void sim_sleep(void);
+
+#define set_sleep_mode(mode)	(sim_sleep_mode = (mode))
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()		sim_sleep()
+
+#endif
@@ -26,6 +26,15 @@ void test_analog()
   printf("\n8BIT10BIT %d %d",x1,x2);
   assert( abs((x1>>2) - x2) < 10 );
 
+  // the oversampled modes should agree with 10-bit mode
+  set_analog_mode(MODE_12_BIT);
+  printf("\nGet12BIT");
+  assert(MODE_12_BIT == get_analog_mode());
+
+  x2 = analog_read(7);
+  printf("\n10BIT12BIT %d %d",x1,x2);
+  assert( abs(x1 - (x2>>2)) < 10 );
+
   // make sure that the average reading is more stable than individual readings
   set_analog_mode(MODE_10_BIT);
   unsigned char i;
@@ -49,6 +58,40 @@ void test_analog()
   printf("\nAB%03x%03x%03x%03x",max,min,avg_max,avg_min);
   assert( max - min >= avg_max - avg_min);
 
+  // readings taken in noise reduction mode should agree with the polled
+  // ones, and should take about as long per sample (times in us)
+  unsigned long start = get_ticks();
+  x1 = analog_read_average(7,100);
+  unsigned long polling_ticks = get_ticks() - start;
+
+  set_analog_noise_reduction(1);
+  start = get_ticks();
+  x2 = analog_read_average(7,100);
+  unsigned long sleep_ticks = get_ticks() - start;
+  set_analog_noise_reduction(0);
+
+  printf("\nNR %d %d %lu %lu", x1, x2, polling_ticks*4/1010, sleep_ticks*4/1010);
+  assert( abs(x1-x2) < 10 );
+
+  // the fast ADC clock profile should agree in 8-bit mode, and be faster
+  set_analog_mode(MODE_8_BIT);
+  start = get_ticks();
+  x1 = analog_read_average(7,100);
+  unsigned long accurate_ticks = get_ticks() - start;
+
+  set_analog_profile(ADC_PROFILE_FAST);
+  printf("\nGetFast");
+  assert(ADC_PROFILE_FAST == get_analog_profile());
+  start = get_ticks();
+  x2 = analog_read_average(7,100);
+  unsigned long fast_ticks = get_ticks() - start;
+  set_analog_profile(ADC_PROFILE_ACCURATE);
+  set_analog_mode(MODE_10_BIT);
+
+  printf("\nFAST %d %d %lu %lu", x1, x2, accurate_ticks*4/1010, fast_ticks*4/1010);
+  assert( abs(x1-x2) < 4 );
+  assert( fast_ticks < accurate_ticks );
+
   // check that temp C and F return appropriate values in 10bit mode
   set_analog_mode(MODE_10_BIT);
   x1 = analog_read_average(6,100);
@@ -124,4 +167,41 @@ void test_analog()
   x2 = to_millivolts(0);
   printf("\nmV6 %d %d",x1,x2);
   assert( x1 == x2 );
+
+  set_analog_mode(MODE_12_BIT);
+
+  x1 = 5000;
+  x2 = to_millivolts(4092);
+  printf("\nmV7 %d %d",x1,x2);
+  assert( x1 == x2 );
+
+  set_analog_mode(MODE_10_BIT);
+
+  // test timed sampling: the trimpot and temperature sensor in turn, one
+  // sample every 10 timer0 overflows (2560 ticks), give or take the
+  // interrupt latency
+  {
+    unsigned char timed_channels[] = { 7, 6 };
+    AnalogSample samples[8], sample;
+    unsigned long previous = 0;
+    int i;
+
+    x1 = analog_read_average(7,20);
+    analog_timed_sampling_start(timed_channels, 2, 10, samples, 8);
+    for(i=0;i<20;i++)
+    {
+      while(!analog_read_timed_sample(&sample));
+      assert( sample.channel == timed_channels[i%2] );
+      if(sample.channel == 7)
+        assert( abs(x1 - (int)sample.value) < 20 );
+      if(i > 0)
+      {
+        printf("\nTimed %lu", sample.ticks - previous);
+        assert( abs((int)(sample.ticks - previous) - 2560) <= 25 );
+      }
+      previous = sample.ticks;
+    }
+    analog_timed_sampling_stop();
+    assert( analog_timed_samples_lost() == 0 );
+  }
 }
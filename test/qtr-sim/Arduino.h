@@ -0,0 +1,26 @@
+/*
+  Arduino.h - The library is compiled for the simulation with ARDUINO
+	defined so that it takes its delay routine from here instead of from
+	the inline assembly in OrangutanTime.  The delay advances the
+	simulated clock.
+*/
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#define INPUT               0
+#define OUTPUT              1
+#define LOW                 0
+#define HIGH                1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void delayMicroseconds(unsigned int microseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,31 @@
+/*
+  OrangutanTime.h - Stands in for the library's OrangutanTime.h, whose
+	delay routines are inline AVR assembly, when the library is compiled
+	for the simulation without ARDUINO defined.  The Makefile includes it
+	ahead of every source file, so its include guard keeps the real
+	header out.  ticks() and delayMicroseconds() advance the simulated
+	clock (see sim.cpp).
+*/
+
+#ifndef OrangutanTime_h
+#define OrangutanTime_h
+
+#ifdef __cplusplus
+
+class OrangutanTime
+{
+  public:
+
+	static unsigned long ticks();
+};
+
+extern "C" {
+#endif
+
+void delayMicroseconds(unsigned int microseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,16 @@
+/*
+  avr/interrupt.h - The simulation delivers interrupts by calling the ISR
+	functions directly, so sei() and cli() do nothing.  ISR_ALIASOF()
+	makes the vector another name for the aliased ISR, as on the AVR.
+*/
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#define sei()
+#define cli()
+
+#define ISR(vector, ...) extern "C" void vector(void) __VA_ARGS__; void vector(void)
+#define ISR_ALIASOF(vector) __attribute__((alias(#vector)))
+
+#endif
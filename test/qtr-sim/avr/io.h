@@ -0,0 +1,58 @@
+/*
+  avr/io.h - Simulated AVR I/O registers for compiling parts of the
+	library on a PC.  The port and ADC registers are ordinary variables.
+	TCNT2 and ADCSRA are routed through the simulation (sim.cpp here, or
+	analog_sim.cpp in ../analog-sim), so that timer2 advances while the
+	library polls it and the ADC completes a conversion while the library
+	waits for ADSC to clear.  Writes to TIFR0 are also passed to the
+	simulation, which clears the flags written as ones.  The pin-change
+	flags are kept by the simulation, so PCIFR is an ordinary variable
+	that nothing reads.  Only the registers used by the simulated modules
+	are declared.
+*/
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern volatile unsigned char PINA, DDRA, PORTA;
+extern volatile unsigned char PINB, DDRB, PORTB;
+extern volatile unsigned char PINC, DDRC, PORTC;
+extern volatile unsigned char PIND, DDRD, PORTD;
+extern volatile unsigned char TCCR0A, TCCR0B;
+extern volatile unsigned char TCCR2A, TCCR2B, TIFR2, TIMSK2;
+extern volatile unsigned char ADMUX;
+extern volatile unsigned int ADC;
+extern volatile unsigned char ADCH;
+extern volatile unsigned char ADCSRB;
+extern volatile unsigned char SREG;
+extern volatile unsigned char PCMSK0, PCMSK1, PCMSK2, PCICR, PCIFR;
+
+volatile unsigned char *sim_tcnt2(void);
+volatile unsigned char *sim_adcsra(void);
+volatile unsigned char *sim_tifr0(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TCNT2	(*sim_tcnt2())
+#define ADCSRA	(*sim_adcsra())
+#define TIFR0	(*sim_tifr0())
+
+#define ADLAR	5
+#define ADSC	6
+#define ADIF	4
+#define ADIE	3
+#define ADATE	5
+#define TOV0	0
+#define TOV2	0
+#define TOIE2	0
+#define PCIE0	0
+#define PCIE1	1
+#define PCIE2	2
+
+#endif
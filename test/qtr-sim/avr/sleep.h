@@ -0,0 +1,18 @@
+/*
+  avr/sleep.h - Only lets OrangutanAnalogScan.cpp compile.  This
+	simulation does not model sleeping, so the noise reduction mode
+	(OrangutanAnalog::setNoiseReduction()) must not be used here; see
+	../analog-sim for that.
+*/
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#define SLEEP_MODE_ADC 1
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu()
+
+#endif
@@ -0,0 +1,930 @@
+/*
+  qtr_sim.cpp - Runs PololuQTRSensors on a PC against the sensor model in
+	sim.cpp, so that changes to the read path can be checked and measured
+	without a robot.
+
+	For each sensor configuration and surface profile, the sensors are
+	calibrated by sweeping the line across the array, and then the line
+	is swept again while readLine() is called once per frame.  For each
+	combination this prints:
+
+	  err      mean and maximum distance between readLine() and the true
+	           line position (the position of sensor n is n*1000)
+	  read us  simulated time taken by one readLine(), i.e. how long the
+	           robot would spend on it
+	  polls    timer2/ADC polls per frame, i.e. iterations of the
+	           library's busy-wait loops
+	  host ns  PC time per frame, which includes the cost of the model
+
+	It then runs checks of particular features, each of which prints what
+	it found.
+
+	The Makefile builds this twice: qtr-sim compiles the library as the
+	Arduino library, and qtr-sim-orangutan compiles it as part of
+	libpololu-avr, where the analog reading takes its ADC clock from
+	OrangutanAnalog and the features that are not available for Arduino
+	are checked too.
+
+	The program exits with a non-zero status if any mean error is larger
+	than the limit for its profile or any check fails.  Note that int is
+	32 bits on a PC, so this cannot catch 16-bit overflows, and it does
+	not measure AVR cycles.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "../../src/PololuQTRSensors/PololuQTRSensors.h"
+#ifndef ARDUINO
+#include "../../src/OrangutanAnalog/OrangutanAnalog.h"
+#endif
+#include "sim.h"
+
+#define NUM_SENSORS 5
+#define EMITTER_PIN 19			// IO_C5, as on the 3pi
+#define CALIBRATION_STEPS 100
+#define FRAMES 400
+
+struct Config
+{
+	const char *name;
+	unsigned char analog;
+	unsigned char readMode;
+	unsigned char edgeLogging;
+	unsigned char adaptiveTimeout;
+};
+
+struct Profile
+{
+	const char *name;
+	float width;
+	float noise;
+	float ambient;
+	float flicker;			// relative change of the ambient light between frames
+	unsigned int maxMeanError;
+};
+
+static const struct Config configs[] = {
+	{ "rc",             0, QTR_EMITTERS_ON,         0, 0 },
+	{ "rc-adaptive",    0, QTR_EMITTERS_ON,         0, 1 },
+	{ "rc-edge-log",    0, QTR_EMITTERS_ON,         1, 0 },
+	{ "rc-on-and-off",  0, QTR_EMITTERS_ON_AND_OFF, 0, 0 },
+	{ "analog",         1, QTR_EMITTERS_ON,         0, 0 },
+	{ "analog-on-off",  1, QTR_EMITTERS_ON_AND_OFF, 0, 0 },
+};
+
+static const struct Profile profiles[] = {
+	{ "clean",     1.0f, 0,     0,     0,    100 },
+	{ "thin-line", 0.5f, 0,     0,     0,    150 },
+	{ "noisy",     1.0f, 0.05f, 0,     0,    150 },
+	{ "ambient",   1.0f, 0.02f, 0.15f, 0.5f, 150 },
+};
+
+// While this is set, calloc() fails.  The Makefile links the program with
+// --wrap=calloc, so this applies to the calloc() calls in the library.
+static unsigned char callocFails;
+
+extern "C" void *__real_calloc(size_t count, size_t size);
+
+extern "C" void *__wrap_calloc(size_t count, size_t size)
+{
+	if (callocFails)
+		return 0;
+	return __real_calloc(count, size);
+}
+
+static double hostNanoseconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Returns 1 if the mean error is within the profile's limit.
+static unsigned char run(const struct Config *c, const struct Profile *p)
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned int values[NUM_SENSORS];
+	PololuQTRSensors *qtr;
+	int i;
+
+	srand(1);
+	sim_surface.line_width = p->width;
+	sim_surface.noise = p->noise;
+	sim_surface.ambient = p->ambient;
+
+	if (c->analog)
+	{
+		sim_init(analogPins, NUM_SENSORS, EMITTER_PIN, 1);
+		qtr = new PololuQTRSensorsAnalog(analogPins, NUM_SENSORS, 4, EMITTER_PIN);
+	}
+	else
+	{
+		PololuQTRSensorsRC *rc = new PololuQTRSensorsRC(rcPins, NUM_SENSORS, 2000, EMITTER_PIN);
+		sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+		rc->setEdgeLogging(c->edgeLogging);
+		rc->setAdaptiveTimeout(c->adaptiveTimeout);
+		qtr = rc;
+	}
+
+	// sweep the line from beyond one end of the array to beyond the other
+	for (i = 0; i < CALIBRATION_STEPS; i++)
+	{
+		sim_surface.line_position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+		qtr->calibrate(c->readMode);
+	}
+
+	// measure while the line moves across the middle of the array, where
+	// readLine() can see it on both sides
+	double totalError = 0, maxError = 0;
+	unsigned long startTime = sim_time;
+	unsigned long startPolls = sim_polls;
+	double startHost = hostNanoseconds();
+	for (i = 0; i < FRAMES; i++)
+	{
+		float position = 0.5f + (NUM_SENSORS - 2.0f) * i / (FRAMES - 1);
+		sim_surface.line_position = position;
+		sim_surface.ambient = p->ambient * (1 + p->flicker * (float)sin(i * 0.7));
+
+		double error = fabs((double)qtr->readLine(values, c->readMode) - position * 1000);
+		totalError += error;
+		if (error > maxError)
+			maxError = error;
+	}
+	double host = hostNanoseconds() - startHost;
+
+	double meanError = totalError / FRAMES;
+	unsigned char pass = meanError <= p->maxMeanError;
+	printf("%-14s %-10s %6.0f %6.0f %9.0f %7lu %9.0f  %s\n", c->name, p->name,
+		meanError, maxError, (sim_time - startTime) * 0.4 / FRAMES,
+		(sim_polls - startPolls) / FRAMES, host / FRAMES, pass ? "ok" : "FAIL");
+
+	delete qtr;
+	return pass;
+}
+
+// Returns 1 if the two arrays of sensor readings are the same.
+static unsigned char sameValues(const unsigned int *a, const unsigned int *b)
+{
+	unsigned char i;
+	for (i = 0; i < NUM_SENSORS; i++)
+		if (a[i] != b[i])
+			return 0;
+	return 1;
+}
+
+// Reads one frame over a dark patch covering the whole array and then
+// follows a line at 2000, with continuous calibration and a 4000-count
+// timeout.  A sensor cut off by the adaptive timeout must not teach the
+// calibration the full timeout: that would squeeze the line's readings
+// toward 0 so that readLine() loses it.  Returns 1 if the line is found
+// with and without the adaptive timeout, and the adaptive timeout raises
+// no calibrated maximum by more than its margin.
+static unsigned char checkAdaptiveContinuous()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned int values[NUM_SENSORS];
+	unsigned char pass = 1;
+	unsigned char adaptive, i;
+
+	for (adaptive = 0; adaptive < 2; adaptive++)
+	{
+		PololuQTRSensorsRC qtr(rcPins, NUM_SENSORS, 4000, EMITTER_PIN);
+		sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+		qtr.setAdaptiveTimeout(adaptive);
+
+		srand(1);
+		sim_surface.line_width = 1.0f;
+		sim_surface.noise = 0;
+		sim_surface.ambient = 0;
+		for (i = 0; i < CALIBRATION_STEPS; i++)
+		{
+			sim_surface.line_position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+			qtr.calibrate();
+		}
+		unsigned int before = 0, after = 0;
+		for (i = 0; i < NUM_SENSORS; i++)
+			if (qtr.calibratedMaximumOn[i] > before)
+				before = qtr.calibratedMaximumOn[i];
+
+		qtr.setContinuousCalibration(4);
+		sim_surface.line_position = 2;
+		sim_surface.line_width = 2.0f * NUM_SENSORS;
+		qtr.readLine(values);
+		for (i = 0; i < NUM_SENSORS; i++)
+			if (qtr.calibratedMaximumOn[i] > after)
+				after = qtr.calibratedMaximumOn[i];
+
+		sim_surface.line_width = 1.0f;
+		unsigned int position = 0;
+		for (i = 0; i < 10; i++)
+			position = qtr.readLine(values);
+
+		unsigned char ok = position > 1900 && position < 2100;
+		if (adaptive && after > before + 100)
+			ok = 0;
+		printf("adaptive timeout %s, continuous calibration: calibrated maximum %u "
+			"before a dark patch, %u after; line at 2000 read as %u  %s\n",
+			adaptive ? "on " : "off", before, after, position, ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+	}
+	return pass;
+}
+
+// Calibrates with the adaptive timeout enabled, calls resetCalibration(),
+// and reads over a dark patch.  No sensor has a calibrated maximum any
+// more, so the reading must use the full timeout and match one taken
+// without the adaptive timeout, instead of cutting every sensor off at
+// the margin.  Returns 1 if it does.
+static unsigned char checkAdaptiveReset()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned int values[2][NUM_SENSORS];
+	unsigned char adaptive, i;
+
+	for (adaptive = 0; adaptive < 2; adaptive++)
+	{
+		PololuQTRSensorsRC qtr(rcPins, NUM_SENSORS, 4000, EMITTER_PIN);
+		sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+		qtr.setAdaptiveTimeout(adaptive);
+
+		sim_surface.line_width = 1.0f;
+		sim_surface.noise = 0;
+		sim_surface.ambient = 0;
+		for (i = 0; i < CALIBRATION_STEPS; i++)
+		{
+			sim_surface.line_position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+			qtr.calibrate();
+		}
+		qtr.resetCalibration();
+
+		sim_surface.line_position = 2;
+		sim_surface.line_width = 2.0f * NUM_SENSORS;
+		qtr.read(values[adaptive]);
+	}
+
+	unsigned char ok = sameValues(values[0], values[1]) && values[1][0] > 100;
+	printf("adaptive timeout after resetCalibration(): dark patch read as %u, %u without it  %s\n",
+		values[1][0], values[0][0], ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// Reads over a dark patch covering all but the first sensor, with and
+// without edge logging.  The first sensor is given a high calibrated
+// maximum, so it has a late adaptive limit but discharges early; the
+// others are cut off by their limits.  Both readings must end at about
+// the same time, once the dark sensors pass their limits and well before
+// the first sensor's limit, and read the same values.  Returns 1 if they
+// do.
+static unsigned char checkEdgeLogAdaptive()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned int values[2][NUM_SENSORS];
+	unsigned long elapsed[2];
+	unsigned char pass = 1;
+	unsigned char edgeLogging, i;
+
+	for (edgeLogging = 0; edgeLogging < 2; edgeLogging++)
+	{
+		PololuQTRSensorsRC qtr(rcPins, NUM_SENSORS, 4000, EMITTER_PIN);
+		sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+		qtr.setEdgeLogging(edgeLogging);
+		qtr.setAdaptiveTimeout(1);
+
+		srand(1);
+		sim_surface.line_width = 1.0f;
+		sim_surface.noise = 0;
+		sim_surface.ambient = 0;
+		for (i = 0; i < CALIBRATION_STEPS; i++)
+		{
+			sim_surface.line_position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+			qtr.calibrate();
+		}
+		qtr.calibratedMaximumOn[0] = 3000;
+
+		sim_surface.line_position = NUM_SENSORS / 2 + 1;
+		sim_surface.line_width = NUM_SENSORS - 1;
+		unsigned long start = sim_time;
+		qtr.readCalibrated(values[edgeLogging]);
+		elapsed[edgeLogging] = sim_time - start;
+		printf("adaptive timeout, edge logging %s: a dark patch took %5.0f us to read  ",
+			edgeLogging ? "on " : "off", elapsed[edgeLogging] * 0.4);
+
+		unsigned char ok = 1;
+		for (i = 0; i < NUM_SENSORS; i++)
+			if (values[edgeLogging][i] != values[0][i])
+				ok = 0;
+		// the dark sensors' limits are about 600 counts after the 200 us
+		// (500 count) emitter settle time
+		if (elapsed[edgeLogging] > elapsed[0] + 50 || elapsed[edgeLogging] > 1500)
+			ok = 0;
+		printf("%s\n", ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+	}
+	return pass;
+}
+
+// Calibrates a sensor object and then reads it calibrated, alternating
+// the readMode, with the line at a few positions.  The values are stored
+// in results.
+static void readModes(PololuQTRSensors *qtr, const unsigned char *pins, unsigned char analog,
+	unsigned int *results)
+{
+	static const unsigned char modes[] = { QTR_EMITTERS_ON, QTR_EMITTERS_OFF,
+		QTR_EMITTERS_ON_AND_OFF, QTR_EMITTERS_ON, QTR_EMITTERS_ON_AND_OFF };
+	unsigned char i, m;
+
+	sim_init(pins, NUM_SENSORS, EMITTER_PIN, analog);
+	sim_surface.line_width = 1.0f;
+	sim_surface.noise = 0;
+	sim_surface.ambient = 0.3f;
+	for (i = 0; i < CALIBRATION_STEPS; i++)
+	{
+		sim_surface.line_position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+		qtr->calibrate(QTR_EMITTERS_ON_AND_OFF);
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		sim_surface.line_position = 0.7f + i * 1.1f;
+		for (m = 0; m < sizeof(modes); m++)
+		{
+			qtr->readCalibrated(results, modes[m]);
+			results += NUM_SENSORS;
+		}
+	}
+}
+
+// Checks that PololuQTRSensorsRCStatic and PololuQTRSensorsAnalogStatic
+// return the same calibrated values as the classes that allocate their
+// arrays, in every readMode, with the modes alternating.  Returns 1 if
+// they do.
+static unsigned char checkStatic()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned int dynamicValues[4 * 5 * NUM_SENSORS], staticValues[4 * 5 * NUM_SENSORS];
+	unsigned char pass = 1;
+	unsigned char analog;
+	unsigned int i, differences;
+
+	for (analog = 0; analog < 2; analog++)
+	{
+		if (analog)
+		{
+			PololuQTRSensorsAnalog dynamicQtr(analogPins, NUM_SENSORS, 4, EMITTER_PIN);
+			PololuQTRSensorsAnalogStatic<NUM_SENSORS> staticQtr(analogPins, 4, EMITTER_PIN);
+			readModes(&dynamicQtr, analogPins, 1, dynamicValues);
+			readModes(&staticQtr, analogPins, 1, staticValues);
+		}
+		else
+		{
+			PololuQTRSensorsRC dynamicQtr(rcPins, NUM_SENSORS, 2000, EMITTER_PIN);
+			PololuQTRSensorsRCStatic<NUM_SENSORS> staticQtr(rcPins, 2000, EMITTER_PIN);
+			readModes(&dynamicQtr, rcPins, 0, dynamicValues);
+			readModes(&staticQtr, rcPins, 0, staticValues);
+		}
+
+		// the values between 0 and 1000 show that the scaling was tested
+		differences = 0;
+		unsigned int scaled = 0;
+		for (i = 0; i < sizeof(dynamicValues) / sizeof(dynamicValues[0]); i++)
+		{
+			if (dynamicValues[i] != staticValues[i])
+				differences++;
+			if (dynamicValues[i] > 0 && dynamicValues[i] < 1000)
+				scaled++;
+		}
+		unsigned char ok = differences == 0 && scaled > 0;
+		printf("%s static class: %u calibrated values (%u between 0 and 1000) compared in "
+			"alternating modes, %u differ  %s\n",
+			analog ? "analog" : "RC", i, scaled, differences, ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+	}
+	return pass;
+}
+
+// Returns the simulated time, in us, that each of count readings takes in
+// the given mode, which are stored in values.
+static float timeReadings(PololuQTRSensors *qtr, unsigned int *values, unsigned char readMode,
+	unsigned char count)
+{
+	unsigned long start = sim_time;
+	unsigned char i;
+	for (i = 0; i < count; i++)
+		qtr->read(values, readMode);
+	return (sim_time - start) * 0.4f / count;
+}
+
+// Times back-to-back QTR_EMITTERS_ON_AND_OFF readings with and without
+// emitter pipelining (setEmitterPipelining()), and QTR_EMITTERS_ON
+// readings of the RC sensors with the default 200 us settle time and with
+// none.  Returns 1 if pipelining saves at least 90% of a settle time per
+// reading without changing the values, and the RC sensors are charged
+// while the emitters settle, so that the settle time only adds 190 us to
+// the 10 us charge.
+static unsigned char checkPipelining()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned int values[2][NUM_SENSORS];
+	unsigned char pass = 1;
+	unsigned char analog, ok;
+
+	sim_surface.line_position = 2.3f;
+	sim_surface.line_width = 1.0f;
+	sim_surface.noise = 0;
+	sim_surface.ambient = 0.3f;
+
+	for (analog = 0; analog < 2; analog++)
+	{
+		PololuQTRSensors *qtr;
+		if (analog)
+		{
+			sim_init(analogPins, NUM_SENSORS, EMITTER_PIN, 1);
+			qtr = new PololuQTRSensorsAnalog(analogPins, NUM_SENSORS, 4, EMITTER_PIN);
+		}
+		else
+		{
+			sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+			qtr = new PololuQTRSensorsRC(rcPins, NUM_SENSORS, 2000, EMITTER_PIN);
+		}
+
+		float plain = timeReadings(qtr, values[0], QTR_EMITTERS_ON_AND_OFF, 10);
+		qtr->setEmitterPipelining(1);
+		timeReadings(qtr, values[1], QTR_EMITTERS_ON_AND_OFF, 1);
+		float pipelined = timeReadings(qtr, values[1], QTR_EMITTERS_ON_AND_OFF, 10);
+		ok = pipelined <= plain - 180 && sameValues(values[0], values[1]);
+		printf("%s on-and-off reading: %4.0f us, %4.0f us pipelined  %s\n",
+			analog ? "analog" : "RC    ", plain, pipelined, ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+
+		if (!analog)
+		{
+			qtr->setEmitterPipelining(0);
+			qtr->emittersOff();
+			float settled = timeReadings(qtr, values[0], QTR_EMITTERS_ON, 1);
+			qtr->setEmitterSettleTime(0);
+			qtr->emittersOff();
+			float unsettled = timeReadings(qtr, values[1], QTR_EMITTERS_ON, 1);
+			ok = settled - unsettled < 191;
+			printf("RC on reading: the 200 us settle time adds %3.0f us  %s\n",
+				settled - unsettled, ok ? "ok" : "FAIL");
+			if (!ok)
+				pass = 0;
+		}
+		delete qtr;
+	}
+	return pass;
+}
+
+// Returns the largest calibrated maximum of any sensor with the emitters
+// on.
+static unsigned int largestMaximum(PololuQTRSensors *qtr)
+{
+	unsigned int largest = 0;
+	unsigned char i;
+	for (i = 0; i < NUM_SENSORS; i++)
+		if (qtr->calibratedMaximumOn[i] > largest)
+			largest = qtr->calibratedMaximumOn[i];
+	return largest;
+}
+
+// Sweeps the line from beyond one end of the array to beyond the other
+// the given number of times, calling readLine() at each step, and
+// returns the mean error of the readings taken over the middle of the
+// array, where readLine() can see the line on both sides.
+static float sweepError(PololuQTRSensors *qtr, unsigned char sweeps)
+{
+	unsigned int values[NUM_SENSORS];
+	float totalError = 0;
+	unsigned int readings = 0;
+	unsigned char sweep, i;
+
+	for (sweep = 0; sweep < sweeps; sweep++)
+	{
+		for (i = 0; i < CALIBRATION_STEPS; i++)
+		{
+			float position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+			sim_surface.line_position = position;
+			unsigned int line = qtr->readLine(values);
+			if (position >= 0.5f && position <= NUM_SENSORS - 1.5f)
+			{
+				totalError += fabsf(line - position * 1000);
+				readings++;
+			}
+		}
+	}
+	return totalError / readings;
+}
+
+// Follows a line with continuous calibration (setContinuousCalibration())
+// and no calibrate() at all, and then turns on an ambient light, which
+// makes every sensor read lower.  It is as bright as the emitters for
+// the RC sensors, and a third of that for the analog sensors, which is
+// already enough to saturate their white readings.  Returns 1 if,
+// for both sensor types, the line is found within 150 of its position
+// after a few sweeps in each lighting, and the calibrated maximums learned
+// in the dark have decayed toward the new, lower readings.
+static unsigned char checkContinuousCalibration()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned char pass = 1;
+	unsigned char analog;
+
+	for (analog = 0; analog < 2; analog++)
+	{
+		PololuQTRSensors *qtr;
+		if (analog)
+		{
+			sim_init(analogPins, NUM_SENSORS, EMITTER_PIN, 1);
+			qtr = new PololuQTRSensorsAnalog(analogPins, NUM_SENSORS, 4, EMITTER_PIN);
+		}
+		else
+		{
+			sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+			qtr = new PololuQTRSensorsRC(rcPins, NUM_SENSORS, 2000, EMITTER_PIN);
+		}
+
+		srand(1);
+		sim_surface.line_width = 1.0f;
+		sim_surface.noise = 0.02f;
+		sim_surface.ambient = 0;
+		qtr->setContinuousCalibration(50);
+		sweepError(qtr, 2);
+		float darkError = sweepError(qtr, 1);
+		unsigned int darkMaximum = largestMaximum(qtr);
+
+		sim_surface.ambient = analog ? 0.3f : 1.0f;
+		sweepError(qtr, 10);
+		float brightError = sweepError(qtr, 1);
+		unsigned int brightMaximum = largestMaximum(qtr);
+
+		unsigned char ok = darkError <= 150 && brightError <= 150 && brightMaximum < darkMaximum;
+		printf("%s continuous calibration: mean error %3.0f, then %3.0f with ambient light; "
+			"calibrated maximum %4u, then %4u  %s\n", analog ? "analog" : "RC    ",
+			darkError, brightError, darkMaximum, brightMaximum, ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+		delete qtr;
+	}
+	return pass;
+}
+
+// Reads two RC arrays, one on port C and one on port D with half the
+// timeout, with readGroup() and then each with read().  A dark patch
+// covers the end of the first array, whose sensors discharge before its
+// timeout, and all of the second, whose sensors do not.  Returns 1 if readGroup() returns the same
+// values as read(), including the second array's own timeout, and takes
+// no longer than the slower of the two read() calls.
+static unsigned char checkGroup()
+{
+	unsigned char pins[2 * NUM_SENSORS] = { 14, 15, 16, 17, 18, 2, 3, 4, 5, 6 };
+	unsigned int groupValues[2][NUM_SENSORS], values[2][NUM_SENSORS];
+	unsigned long elapsed[2];
+	unsigned char j;
+
+	PololuQTRSensorsRC front(pins, NUM_SENSORS, 2000, EMITTER_PIN);
+	PololuQTRSensorsRC rear(pins + NUM_SENSORS, NUM_SENSORS, 1000, EMITTER_PIN);
+	PololuQTRSensorsRCBase *arrays[] = { &front, &rear };
+	unsigned int *sensor_values[] = { groupValues[0], groupValues[1] };
+
+	sim_init(pins, 2 * NUM_SENSORS, EMITTER_PIN, 0);
+	sim_surface.line_position = 6.5f;
+	sim_surface.line_width = 7.0f;
+	sim_surface.noise = 0;
+	sim_surface.ambient = 0;
+
+	unsigned long start = sim_time;
+	PololuQTRSensorsRCBase::readGroup(arrays, sensor_values, 2);
+	unsigned long groupElapsed = sim_time - start;
+
+	for (j = 0; j < 2; j++)
+	{
+		start = sim_time;
+		arrays[j]->read(values[j]);
+		elapsed[j] = sim_time - start;
+	}
+
+	unsigned char ok = sameValues(groupValues[0], values[0]) &&
+		sameValues(groupValues[1], values[1]) && values[0][NUM_SENSORS - 1] > 1000 &&
+		values[0][NUM_SENSORS - 1] < 2000 && values[1][0] == 1000 &&
+		groupElapsed <= (elapsed[0] > elapsed[1] ? elapsed[0] : elapsed[1]) + 50;
+	printf("readGroup() of two arrays: %4.0f us, read() of each: %4.0f us and %4.0f us  %s\n",
+		groupElapsed * 0.4, elapsed[0] * 0.4, elapsed[1] * 0.4, ok ? "ok" : "FAIL");
+	return ok;
+}
+
+// Compares readCalibrated() with its scale table and with the division it
+// falls back on when the table cannot be allocated, which is forced by
+// making calloc() fail.  Two sensor objects are calibrated the same way
+// and then read alternately as the line moves.  Only the values are
+// compared: the time a PC takes says nothing about the AVR's cycles, so
+// this does not show whether the table is faster.  Returns 1 if, for
+// both sensor types, the two ways never differ by more than 1, which is
+// how much the rounded-up scale factor can add.
+static unsigned char checkScaling()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned int values[2][NUM_SENSORS];
+	unsigned char pass = 1;
+	unsigned char analog, j;
+	unsigned int i;
+
+	for (analog = 0; analog < 2; analog++)
+	{
+		PololuQTRSensors *qtr[2];
+		for (j = 0; j < 2; j++)
+		{
+			if (analog)
+				qtr[j] = new PololuQTRSensorsAnalog(analogPins, NUM_SENSORS, 1, EMITTER_PIN);
+			else
+				qtr[j] = new PololuQTRSensorsRC(rcPins, NUM_SENSORS, 2000, EMITTER_PIN);
+		}
+		sim_init(analog ? analogPins : rcPins, NUM_SENSORS, EMITTER_PIN, analog);
+		sim_surface.line_width = 1.0f;
+		sim_surface.noise = 0;
+		sim_surface.ambient = 0;
+		for (i = 0; i < CALIBRATION_STEPS; i++)
+		{
+			sim_surface.line_position = -1.5f + (NUM_SENSORS + 2.0f) * i / (CALIBRATION_STEPS - 1);
+			qtr[0]->calibrate();
+			qtr[1]->calibrate();
+		}
+		unsigned int largestDifference = 0;
+		for (i = 0; i < FRAMES; i++)
+		{
+			sim_surface.line_position = 0.5f + (NUM_SENSORS - 2.0f) * (i % 100) / 99;
+			qtr[0]->readCalibrated(values[0]);
+			// readCalibrated() tries to allocate the table each time
+			callocFails = 1;
+			qtr[1]->readCalibrated(values[1]);
+			callocFails = 0;
+			for (j = 0; j < NUM_SENSORS; j++)
+			{
+				unsigned int difference = abs((int)values[0][j] - (int)values[1][j]);
+				if (difference > largestDifference)
+					largestDifference = difference;
+			}
+		}
+
+		unsigned char ok = largestDifference <= 1;
+		printf("%s readCalibrated() with the scale table and with division: "
+			"largest difference %u  %s\n", analog ? "analog" : "RC    ", largestDifference,
+			ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+		delete qtr[0];
+		delete qtr[1];
+	}
+	return pass;
+}
+
+#ifndef ARDUINO
+// Reads the analog sensors with each of OrangutanAnalog's clock profiles,
+// which readPrivate() takes from OrangutanAnalog::getADCSRA().  Returns 1
+// if the readings are the same, each faster profile takes less time, and
+// ADCSRA is restored afterwards.
+static unsigned char checkAdcProfiles()
+{
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned int values[3][NUM_SENSORS];
+	unsigned long elapsed[3];
+	unsigned char pass = 1;
+	unsigned char profile, i;
+
+	PololuQTRSensorsAnalog qtr(analogPins, NUM_SENSORS, 4, EMITTER_PIN);
+	sim_init(analogPins, NUM_SENSORS, EMITTER_PIN, 1);
+	sim_surface.line_position = 2.3f;
+	sim_surface.line_width = 1.0f;
+	sim_surface.noise = 0;
+	sim_surface.ambient = 0;
+
+	for (profile = ADC_PROFILE_ACCURATE; profile <= ADC_PROFILE_FAST; profile++)
+	{
+		OrangutanAnalog::setProfile(profile);
+		ADCSRA = 0x07;
+		unsigned long start = sim_time;
+		qtr.read(values[profile]);
+		elapsed[profile] = sim_time - start;
+
+		unsigned char ok = ADCSRA == 0x07;
+		for (i = 0; i < NUM_SENSORS; i++)
+			if (values[profile][i] != values[0][i])
+				ok = 0;
+		if (profile > ADC_PROFILE_ACCURATE && elapsed[profile] >= elapsed[profile - 1])
+			ok = 0;
+		printf("ADC profile %u: read took %5.0f us  %s\n", profile, elapsed[profile] * 0.4,
+			ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+	}
+	OrangutanAnalog::setProfile(ADC_PROFILE_ACCURATE);
+	ADCSRA = 0;
+	return pass;
+}
+
+// Reads the RC sensors in the background with readStart(), calling
+// readPoll() between 20 us delays during which the pin-change interrupts
+// time the discharges, and once with readComplete().  The line is put at
+// a few positions, and then a dark patch covers the array so that the
+// sensors time out.  Finally the line is read under ambient light with
+// the emitters off (after leaving them on, so readStart() has to turn
+// them off), and QTR_EMITTERS_ON_AND_OFF is passed, which
+// readStart() rejects.  Returns 1 if every background reading is within
+// a few ticks of read() in the same mode, readPoll() returns 0 at least
+// once, the dark sensors read as the timeout, the emitters end up off,
+// and the rejected read leaves the values alone.
+static unsigned char checkAsync()
+{
+	unsigned char rcPins[NUM_SENSORS] = { 14, 15, 16, 17, 18 };
+	unsigned int expected[NUM_SENSORS], values[NUM_SENSORS];
+	unsigned char pass = 1;
+	unsigned char step, i;
+
+	PololuQTRSensorsRC qtr(rcPins, NUM_SENSORS, 1000, EMITTER_PIN);
+	sim_init(rcPins, NUM_SENSORS, EMITTER_PIN, 0);
+	sim_surface.line_width = 1.0f;
+	sim_surface.noise = 0;
+	sim_surface.ambient = 0;
+
+	for (step = 0; step < 7; step++)
+	{
+		unsigned char dark = step == 5;
+		unsigned char readMode = step == 6 ? QTR_EMITTERS_OFF : QTR_EMITTERS_ON;
+		sim_surface.line_position = dark ? 2 : 0.3f + step * 0.9f;
+		sim_surface.line_width = dark ? 2.0f * NUM_SENSORS : 1.0f;
+		sim_surface.ambient = step == 6 ? 0.5f : 0;
+		qtr.read(expected, readMode);
+
+		unsigned int waits = 0;
+		if (step == 4)
+		{
+			qtr.readStart(values);
+			qtr.readComplete();
+		}
+		else
+		{
+			if (readMode == QTR_EMITTERS_OFF)
+				qtr.emittersOn();
+			qtr.readStart(values, readMode);
+			while (!qtr.readPoll())
+			{
+				delayMicroseconds(20);
+				waits++;
+			}
+		}
+
+		unsigned int maxDifference = 0;
+		for (i = 0; i < NUM_SENSORS; i++)
+		{
+			unsigned int difference = abs((int)values[i] - (int)expected[i]);
+			if (difference > maxDifference)
+				maxDifference = difference;
+			if (dark && values[i] != 1000)
+				maxDifference = 1000;
+		}
+		unsigned char ok = maxDifference <= 4 && !(PORTC & (1 << (EMITTER_PIN - 14)));
+		if (step != 4 && waits == 0)
+			ok = 0;
+		printf("background RC read %s: %2u polls, largest difference from read() %u  %s\n",
+			dark ? "of a dark patch   " : step == 4 ? "with readComplete()" :
+			step == 6 ? "with emitters off " : "with readPoll()    ",
+			waits, maxDifference, ok ? "ok" : "FAIL");
+		if (!ok)
+			pass = 0;
+	}
+
+	for (i = 0; i < NUM_SENSORS; i++)
+		values[i] = 12345;
+	qtr.readStart(values, QTR_EMITTERS_ON_AND_OFF);
+	unsigned char ok = qtr.readPoll();
+	for (i = 0; i < NUM_SENSORS; i++)
+		if (values[i] != 12345)
+			ok = 0;
+	printf("background RC read with emitters on and off: rejected  %s\n", ok ? "ok" : "FAIL");
+	if (!ok)
+		pass = 0;
+	sim_surface.ambient = 0;
+	return pass;
+}
+
+// Scans the analog sensors in the background with the line at one
+// position, then moves it and reads again after less than a frame and
+// after two frames, and finally stops the scan.  A frame of 5 sensors
+// with 4 samples each takes about 1660 us.  Returns 1 if the first frame
+// matches read(), the first frame is still returned after the line moves
+// until a whole new frame has been taken, which then matches read(), and
+// scanStop() restores the ADC and port registers.
+static unsigned char checkScan()
+{
+	unsigned char analogPins[NUM_SENSORS] = { 0, 1, 2, 3, 4 };
+	unsigned int first[NUM_SENSORS], second[NUM_SENSORS], values[NUM_SENSORS];
+	unsigned char pass = 1;
+	unsigned char ok;
+
+	PololuQTRSensorsAnalog qtr(analogPins, NUM_SENSORS, 4, EMITTER_PIN);
+	sim_init(analogPins, NUM_SENSORS, EMITTER_PIN, 1);
+	sim_surface.line_width = 1.0f;
+	sim_surface.noise = 0;
+	sim_surface.ambient = 0;
+
+	sim_surface.line_position = 3.1f;
+	qtr.read(second);
+	sim_surface.line_position = 1.3f;
+	qtr.read(first);
+
+	ADMUX = 0x05;
+	ADCSRA = 0x86;
+	DDRC = 0x41;
+	PORTC = 0x41;
+
+	unsigned long start = sim_time;
+	qtr.scanStart();
+	qtr.read(values);
+	ok = sameValues(values, first);
+	printf("scan: first frame after %5.0f us matches read()  %s\n",
+		(sim_time - start) * 0.4, ok ? "ok" : "FAIL");
+	if (!ok)
+		pass = 0;
+
+	sim_surface.line_position = 3.1f;
+	delayMicroseconds(500);
+	qtr.read(values);
+	ok = sameValues(values, first);
+	printf("scan: 500 us after the line moved, read() returns the last complete frame  %s\n",
+		ok ? "ok" : "FAIL");
+	if (!ok)
+		pass = 0;
+
+	delayMicroseconds(3400);
+	qtr.read(values);
+	ok = sameValues(values, second);
+	printf("scan: two frames later, read() returns the new position  %s\n",
+		ok ? "ok" : "FAIL");
+	if (!ok)
+		pass = 0;
+
+	qtr.scanStop();
+	qtr.read(values);
+	ok = ADMUX == 0x05 && ADCSRA == (0x86 | (1 << ADIF)) && DDRC == 0x61 && PORTC == 0x41 &&
+		sameValues(values, second);
+	printf("scan: scanStop() restores the registers and read() converts again  %s\n",
+		ok ? "ok" : "FAIL");
+	if (!ok)
+		pass = 0;
+
+	DDRC = PORTC = 0;
+	ADMUX = ADCSRA = 0;
+	return pass;
+}
+#endif
+
+int main()
+{
+	unsigned int i, j;
+	unsigned char pass = 1;
+
+	printf("%-14s %-10s %6s %6s %9s %7s %9s\n", "sensors", "profile",
+		"err", "max", "read us", "polls", "host ns");
+	for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+		for (j = 0; j < sizeof(profiles) / sizeof(profiles[0]); j++)
+			if (!run(&configs[i], &profiles[j]))
+				pass = 0;
+
+	printf("\n");
+	if (!checkAdaptiveContinuous())
+		pass = 0;
+	if (!checkEdgeLogAdaptive())
+		pass = 0;
+	if (!checkAdaptiveReset())
+		pass = 0;
+	if (!checkStatic())
+		pass = 0;
+	if (!checkPipelining())
+		pass = 0;
+	if (!checkContinuousCalibration())
+		pass = 0;
+	if (!checkGroup())
+		pass = 0;
+	if (!checkScaling())
+		pass = 0;
+#ifndef ARDUINO
+	if (!checkAdcProfiles())
+		pass = 0;
+	if (!checkAsync())
+		pass = 0;
+	if (!checkScan())
+		pass = 0;
+#endif
+
+	return pass ? 0 : 1;
+}
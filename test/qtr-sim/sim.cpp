@@ -0,0 +1,297 @@
+/*
+  sim.cpp - A simple model of a QTR sensor array over a line.  See sim.h.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include "avr/io.h"
+#include "Arduino.h"
+#include "sim.h"
+
+volatile unsigned char PINA, DDRA, PORTA;
+volatile unsigned char PINB, DDRB, PORTB;
+volatile unsigned char PINC, DDRC, PORTC;
+volatile unsigned char PIND, DDRD, PORTD;
+volatile unsigned char TCCR0A, TCCR0B;
+volatile unsigned char TCCR2A, TCCR2B, TIFR2, TIMSK2;
+volatile unsigned char ADMUX;
+volatile unsigned int ADC;
+volatile unsigned char ADCH;
+volatile unsigned char ADCSRB;
+volatile unsigned char SREG;
+volatile unsigned char PCMSK0, PCMSK1, PCMSK2, PCICR, PCIFR;
+volatile unsigned long tickCount;
+
+static volatile unsigned char tcnt2;
+static volatile unsigned char adcsra;
+
+// The pin-change interrupt flags, one per port as in PCIFR.
+static unsigned char pcif;
+
+#ifndef ARDUINO
+extern "C" void PCINT0_vect(void);
+extern "C" void PCINT1_vect(void);
+extern "C" void PCINT2_vect(void);
+extern "C" void ADC_vect(void);
+#endif
+
+unsigned long sim_time;
+unsigned long sim_polls;
+unsigned char sim_ticks_per_poll = 2;
+struct SimSurface sim_surface = { 0, 1, 0, 0 };
+
+#define SIM_MAX_SENSORS 16
+
+// Discharge time of a QTR-RC sensor on white with the emitters on.
+#define RC_WHITE_TICKS 150
+
+// Width of the spot seen by each sensor, in sensor spacings.
+#define SPOT_SIGMA 0.4f
+
+struct SimPin
+{
+	volatile unsigned char *pin;
+	volatile unsigned char *ddr;
+	volatile unsigned char *port;
+	volatile unsigned char *pcmsk;
+	unsigned char pcie;
+	unsigned char bitmask;
+};
+
+static struct SimPin sensors[SIM_MAX_SENSORS];
+static unsigned long chargedTime[SIM_MAX_SENSORS];
+static unsigned long dischargeTicks[SIM_MAX_SENSORS];
+static unsigned char channelSensor[16];
+static unsigned char numSimSensors;
+static unsigned char simAnalog;
+static struct SimPin emitter;
+static unsigned char hasEmitter;
+
+// Uses the same pin numbering as OrangutanDigital on the mega168/328.
+static void lookupPin(unsigned char pin, struct SimPin *p)
+{
+	if (pin < 8)
+	{
+		p->pin = &PIND; p->ddr = &DDRD; p->port = &PORTD;
+		p->pcmsk = &PCMSK2; p->pcie = PCIE2;
+		p->bitmask = 1 << pin;
+	}
+	else if (pin < 14)
+	{
+		p->pin = &PINB; p->ddr = &DDRB; p->port = &PORTB;
+		p->pcmsk = &PCMSK0; p->pcie = PCIE0;
+		p->bitmask = 1 << (pin - 8);
+	}
+	else
+	{
+		p->pin = &PINC; p->ddr = &DDRC; p->port = &PORTC;
+		p->pcmsk = &PCMSK1; p->pcie = PCIE1;
+		p->bitmask = 1 << (pin - 14);
+	}
+}
+
+static float gaussian()
+{
+	float u = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+	float v = (rand() + 1.0f) / (RAND_MAX + 2.0f);
+	return sqrtf(-2 * logf(u)) * cosf(6.2831853f * v);
+}
+
+// Returns the reflectance seen by sensor i, from 1 on white down to 0.1
+// when its whole spot is on the line.
+static float reflectance(unsigned char i)
+{
+	float left = (sim_surface.line_position - sim_surface.line_width / 2 - i) / (SPOT_SIGMA * 1.4142136f);
+	float right = (sim_surface.line_position + sim_surface.line_width / 2 - i) / (SPOT_SIGMA * 1.4142136f);
+	float coverage = (erff(right) - erff(left)) / 2;
+	return 1 - 0.9f * coverage;
+}
+
+static float light(unsigned char i)
+{
+	float emitted = 0;
+	if (hasEmitter && (*emitter.ddr & emitter.bitmask) && (*emitter.port & emitter.bitmask))
+		emitted = 1;
+	float l = (emitted + sim_surface.ambient) * reflectance(i);
+	return l * (1 + sim_surface.noise * gaussian());
+}
+
+// Calls the ISRs of the pin-change interrupts that are flagged and
+// enabled, unless one of them is already running.  The ISRs read TCNT2,
+// which brings the pins up to date again and can flag more changes;
+// those are delivered by the same loop once the ISR returns.
+static void pinChangeInterrupts()
+{
+#ifndef ARDUINO
+	static unsigned char running;
+	unsigned char pending;
+
+	if (running)
+		return;
+	running = 1;
+	while ((pending = pcif & PCICR) != 0)
+	{
+		pcif &= ~pending;
+		if (pending & (1 << PCIE0))
+			PCINT0_vect();
+		if (pending & (1 << PCIE1))
+			PCINT1_vect();
+		if (pending & (1 << PCIE2))
+			PCINT2_vect();
+	}
+	running = 0;
+#endif
+}
+
+// Brings the PIN registers of the QTR-RC sensors up to date.  A sensor
+// that is being driven high is charged, and once released it reads high
+// until it has discharged.  A change of a pin that is enabled in its
+// PCMSK register sets the flag of its pin-change interrupt.
+static void update()
+{
+	unsigned char i;
+
+	if (simAnalog)
+		return;
+
+	for (i = 0; i < numSimSensors; i++)
+	{
+		struct SimPin *p = &sensors[i];
+		unsigned char high;
+
+		if (*p->ddr & p->bitmask)
+		{
+			high = *p->port & p->bitmask;
+			if (high)
+			{
+				float l = light(i);
+				chargedTime[i] = sim_time;
+				dischargeTicks[i] = l > RC_WHITE_TICKS / 65535.0f ? (unsigned long)(RC_WHITE_TICKS / l) : 65535;
+			}
+		}
+		else
+			high = sim_time - chargedTime[i] < dischargeTicks[i];
+
+		if (!high != !(*p->pin & p->bitmask) && (*p->pcmsk & p->bitmask))
+			pcif |= 1 << p->pcie;
+
+		if (high)
+			*p->pin |= p->bitmask;
+		else
+			*p->pin &= ~p->bitmask;
+	}
+
+	pinChangeInterrupts();
+}
+
+void sim_init(const unsigned char *pins, unsigned char numSensors,
+	unsigned char emitterPin, unsigned char analog)
+{
+	unsigned char i;
+
+	numSimSensors = numSensors;
+	simAnalog = analog;
+	for (i = 0; i < numSensors; i++)
+	{
+		if (analog)
+		{
+			channelSensor[pins[i]] = i;
+			lookupPin(14 + pins[i], &sensors[i]);
+		}
+		else
+			lookupPin(pins[i], &sensors[i]);
+		chargedTime[i] = 0;
+		dischargeTicks[i] = 0;
+	}
+	pcif = 0;
+
+	hasEmitter = emitterPin < 20;
+	if (hasEmitter)
+		lookupPin(emitterPin, &emitter);
+}
+
+volatile unsigned char *sim_tcnt2()
+{
+	sim_time += sim_ticks_per_poll;
+	sim_polls++;
+	tcnt2 = (unsigned char)sim_time;
+	tickCount = sim_time & ~0xFFUL;
+	update();
+	return &tcnt2;
+}
+
+#ifndef ARDUINO
+// OrangutanTime keeps the high bytes of the tick count in tickCount and
+// takes the low byte from TCNT2.
+unsigned long OrangutanTime::ticks()
+{
+	sim_tcnt2();
+	return sim_time;
+}
+#endif
+
+// Returns how long a conversion takes, in ticks: 13 ADC clocks at 20 MHz
+// divided by the prescaler selected in ADCSRA.
+static unsigned long conversionTicks()
+{
+	unsigned char prescaler = adcsra & 7;
+	return 13UL * (prescaler ? 1 << prescaler : 2) / 8;
+}
+
+// Finishes the conversion in progress.  The phototransistor pulls the
+// output down in proportion to the light until it saturates.  If the ADC
+// interrupt is enabled, its ISR is called, which usually starts the next
+// conversion.
+static void convert()
+{
+	float l = light(channelSensor[ADMUX & 0x0F]);
+	float value = 1023 * (1 - 0.85f * l);
+	ADC = value < 0 ? 0 : value > 1023 ? 1023 : (unsigned int)value;
+	ADCH = ADC >> 2;
+	adcsra = (adcsra & ~(1 << ADSC)) | (1 << ADIF);
+	sim_time += conversionTicks();
+#ifndef ARDUINO
+	if (adcsra & (1 << ADIE))
+	{
+		adcsra &= ~(1 << ADIF);
+		ADC_vect();
+	}
+#endif
+}
+
+// A conversion that has been started completes the next time ADCSRA is
+// read.
+volatile unsigned char *sim_adcsra()
+{
+	if (adcsra & (1 << ADSC))
+		convert();
+	sim_polls++;
+	return &adcsra;
+}
+
+// Advances the clock.  While the pin-change interrupts are enabled, the
+// pins are brought up to date at every poll interval so that the ISRs
+// see the discharges when they happen, and while the ADC interrupt is
+// enabled, conversions that finish in time complete as they would in the
+// background.
+void delayMicroseconds(unsigned int microseconds)
+{
+	unsigned long end = sim_time + microseconds * 5UL / 2;
+
+	while (sim_time < end)
+	{
+		if ((adcsra & (1 << ADSC)) && (adcsra & (1 << ADIE)) &&
+			sim_time + conversionTicks() <= end)
+			convert();
+		else if (PCICR)
+		{
+			sim_time += sim_ticks_per_poll;
+			update();
+		}
+		else
+			break;
+	}
+	if (sim_time < end)
+		sim_time = end;
+	update();
+}
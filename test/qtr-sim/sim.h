@@ -0,0 +1,49 @@
+/*
+  sim.h - A simple model of a QTR sensor array over a line, driving the
+	simulated registers in avr/io.h.
+
+	The surface is a dark line on a white background.  Each sensor sees a
+	blurred spot of the surface under it, and the light it receives is
+	the emitter light plus the ambient light, reflected by that spot.
+	A QTR-RC sensor discharges in a time inversely proportional to that
+	light, and a QTR-A sensor's voltage drops linearly as the light increases.
+	Every sample gets gaussian noise of the given relative size.
+
+	When the library is compiled without ARDUINO, the model also delivers
+	the pin-change interrupts of the sensor pins and the ADC
+	conversion-complete interrupt by calling their ISRs, with no latency.
+	Time only passes when the library or the test polls timer2, reads
+	ADCSRA, or delays, so a test lets a background read or scan run by
+	calling delayMicroseconds().
+*/
+
+#ifndef SIM_H
+#define SIM_H
+
+// The simulated clock, in timer2 ticks of 0.4 us.
+extern unsigned long sim_time;
+
+// The number of times the library polled timer2 or the ADC.  This
+// counts the iterations of the library's busy-wait loops.
+extern unsigned long sim_polls;
+
+// How far the clock advances each time the library polls timer2, which
+// stands in for the time that one iteration of the RC timing loop takes.
+extern unsigned char sim_ticks_per_poll;
+
+struct SimSurface
+{
+	float line_position;	// center of the line, in sensor spacings from sensor 0
+	float line_width;		// in sensor spacings
+	float noise;			// relative standard deviation of each sample
+	float ambient;			// ambient light, relative to the emitters
+};
+
+extern struct SimSurface sim_surface;
+
+// Attaches the model to the given sensor pins (digital pin numbers for
+// QTR-RC sensors, analog channels for QTR-A sensors) and emitter pin.
+void sim_init(const unsigned char *pins, unsigned char numSensors,
+	unsigned char emitterPin, unsigned char analog);
+
+#endif
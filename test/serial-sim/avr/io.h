@@ -0,0 +1,52 @@
+/*
+  avr/io.h - Simulated USART0 registers for compiling OrangutanSerial on a
+	PC.  UCSR0A, UCSR0B, and UDR0 are objects whose reads and writes are
+	passed to the simulation in serial_sim.cpp, so that reading UDR0 takes
+	a byte from the receive FIFO, writing it starts a transmission, and
+	polling UCSR0A lets simulated time pass.  Timer2 is only read, for
+	receive timestamps, so TCNT2 is plain memory that the simulation keeps
+	up to date.  Only the registers used by OrangutanSerial on the
+	ATmega48/168/328 are declared.
+*/
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+class SimRegister
+{
+  public:
+	SimRegister(unsigned char (*read)(), void (*write)(unsigned char)) : read(read), write(write) {}
+	operator unsigned char() const { return read(); }
+	SimRegister &operator=(unsigned char value) { write(value); return *this; }
+	SimRegister &operator|=(unsigned char value) { write(read() | value); return *this; }
+	SimRegister &operator&=(int value) { write(read() & value); return *this; }
+
+  private:
+	unsigned char (*read)();
+	void (*write)(unsigned char);
+};
+
+extern SimRegister UCSR0A, UCSR0B, UDR0;
+extern volatile unsigned char UCSR0C;
+extern volatile unsigned int UBRR0;
+extern volatile unsigned char SREG;
+extern volatile unsigned char TCNT2, TIFR2;
+
+#define USART_RX_vect	sim_usart_rx_vect
+#define USART_UDRE_vect	sim_usart_udre_vect
+
+// UCSR0A
+#define RXC0	7
+#define UDRE0	5
+#define DOR0	3
+
+// UCSR0B
+#define RXCIE0	7
+#define UDRIE0	5
+#define RXEN0	4
+#define TXEN0	3
+
+// TIFR2
+#define TOV2	0
+
+#endif
@@ -0,0 +1,924 @@
+/*
+  serial_sim.cpp - Benchmarks OrangutanSerial on a PC against a simulated
+	USART, to measure what it sustains at 115200 baud and above in
+	SERIAL_AUTOMATIC and SERIAL_CHECK mode, with different buffer sizes
+	and different amounts of work between calls from the main loop.
+
+	The host on the other end streams bytes with consecutive sequence
+	numbers as fast as the baud rate allows while the main loop takes
+	them out of a receiveRing() buffer, and the main loop keeps the
+	transmitter fed with send(), queueSend(), or sendSegments() while the
+	simulation checks that the bytes on the wire are consecutive too.
+	Each main loop iteration does a fixed amount of other work, calls
+	check() in SERIAL_CHECK mode, and then services both directions.
+
+	Like the real USART, the receiver has a two-byte FIFO, and a byte that
+	finishes arriving while the FIFO is full is lost (a data overrun).
+	The transmitter has a one-byte buffer in front of the shift register.
+	A byte takes 10 bit times at the baud rate the library selects with
+	UBRR0, so 115200 baud is really 113636 baud at 20 MHz.  Interrupts are
+	taken as soon as they are pending and enabled, outside of other
+	interrupts, and each one takes the fixed number of CPU cycles below
+	from the code it interrupts.  Those costs are assumed inputs, guesses
+	at what avr-gcc produces for the ISRs including the vector and the
+	register saves, not measurements: they were not taken from avr-objdump
+	and do not change when the library does.  So the isr % column, and the
+	rates insofar as they depend on the CPU time the interrupts take, are
+	only as good as those guesses.  The host ns column is the PC time
+	per interrupt, which is only useful for comparing library changes.
+	Timer2 runs at 2.5 MHz, as set up by OrangutanTime, so that receive
+	timestamps can be checked against the time each byte arrived.
+	For each combination this prints:
+
+	  rx B/s    bytes received in order per second
+	  lost      bytes that never made it to the main loop, to data overruns
+	            or to the ring buffer being overwritten
+	  dor       data overruns in the USART
+	  tx B/s    bytes transmitted per second
+	  tx %      tx B/s as a percentage of the line rate
+	  isr/B     interrupts per byte received or transmitted
+	  isr %     CPU time spent in interrupts, from the assumed costs
+	  host ns   PC time per interrupt
+
+	Built with RAMEND defined as on the ATmega1284P (serial-sim-16), the
+	library uses 16-bit buffer indices, and 1024-byte buffers are tried
+	too.
+
+	After the benchmark, the host sends fixed byte streams instead of
+	sequence numbers to check the frame decoders of receiveFrames().
+
+	The program exits with a non-zero status if a byte is ever repeated,
+	reordered, or corrupted, if SERIAL_AUTOMATIC mode with a 32-byte or
+	larger buffer and a responsive main loop loses any byte or leaves the
+	transmitter idle more than 5% of the time, or if a receive timestamp
+	is earlier than the byte's arrival or more than a byte time later,
+	or if one of the checks after the benchmark fails.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "avr/io.h"
+#include "../../src/OrangutanSerial/OrangutanSerial.h"
+#include "../../src/OrangutanSerialCommands/OrangutanSerialCommands.h"
+#include "../../src/OrangutanTime/OrangutanTime.h"
+
+#define F_CPU_HZ 20000000UL
+#define CYCLES_PER_TICK 8	// timer2 runs at F_CPU / 8
+
+// assumed (not measured) cost of each interrupt, in CPU cycles
+#define RX_ISR_CYCLES 75
+#define UDRE_ISR_CYCLES 85
+
+#define CYCLES_PER_POLL 5
+#define SIM_CYCLES (F_CPU_HZ / 20)	// 50 ms per run
+#define NEVER (~0ULL)
+
+volatile unsigned char UCSR0C;
+volatile unsigned int UBRR0;
+volatile unsigned char SREG;
+volatile unsigned char TCNT2, TIFR2;
+volatile unsigned long tickCount;
+
+extern "C" void USART_RX_vect(void);
+extern "C" void USART_UDRE_vect(void);
+
+// The simulated clock, in CPU cycles at 20 MHz.
+static unsigned long long sim_cycles;
+static unsigned long byte_cycles;
+static unsigned char ucsr0b;
+static unsigned char in_isr;
+
+// Receiver: when the next byte finishes arriving, the FIFO, and the
+// sequence number of the next byte the host sends.
+static unsigned long long rx_next;
+static unsigned char rx_fifo[2];
+static unsigned char rx_count;
+static unsigned char rx_dor;
+static unsigned char rx_sequence;
+static unsigned long rx_sent;
+static unsigned long rx_overruns;
+
+// If not 0, the host sends these bytes once instead of sequence numbers.
+static const unsigned char *rx_script;
+static unsigned int rx_script_size;
+
+// Transmitter: the buffer, when the shift register finishes the byte in
+// it, and the byte expected next on the wire.
+static unsigned char tx_buffer;
+static unsigned char tx_buffer_full;
+static unsigned long long tx_shift_end;
+static unsigned char tx_expected;
+static unsigned long tx_bytes;
+static unsigned long tx_errors;
+
+// If not 0, the bytes on the wire are stored here instead of being
+// checked against the sequence.
+static unsigned char *tx_log;
+static unsigned int tx_log_size;
+
+static unsigned long rx_isrs, udre_isrs;
+static double isr_host_ns;
+
+static void advance(unsigned long cycles);
+
+static unsigned char readUCSR0A()
+{
+	if (!in_isr)
+		advance(CYCLES_PER_POLL);
+	return (rx_count ? 1 << RXC0 : 0) | (tx_buffer_full ? 0 : 1 << UDRE0) | (rx_dor ? 1 << DOR0 : 0);
+}
+
+static void writeUCSR0A(unsigned char value)
+{
+}
+
+static unsigned char readUCSR0B()
+{
+	return ucsr0b;
+}
+
+static void writeUCSR0B(unsigned char value)
+{
+	ucsr0b = value;
+}
+
+static unsigned char readUDR0()
+{
+	unsigned char byte = rx_fifo[0];
+	if (rx_count)
+	{
+		rx_fifo[0] = rx_fifo[1];
+		rx_count--;
+		rx_dor = 0;
+	}
+	return byte;
+}
+
+static void startShift(unsigned char byte)
+{
+	if (tx_log)
+	{
+		if (tx_bytes < tx_log_size)
+			tx_log[tx_bytes] = byte;
+	}
+	else if (byte != tx_expected)
+		tx_errors++;
+	tx_expected = byte + 1;
+	tx_bytes++;
+	tx_shift_end = sim_cycles + byte_cycles;
+}
+
+static void writeUDR0(unsigned char byte)
+{
+	if (tx_shift_end == NEVER)
+		startShift(byte);
+	else if (!tx_buffer_full)
+	{
+		tx_buffer = byte;
+		tx_buffer_full = 1;
+	}
+	else
+		tx_errors++;	// written while UDRE was clear, so the byte is lost
+}
+
+SimRegister UCSR0A(readUCSR0A, writeUCSR0A);
+SimRegister UCSR0B(readUCSR0B, writeUCSR0B);
+SimRegister UDR0(readUDR0, writeUDR0);
+
+extern "C" unsigned long get_ms()
+{
+	return sim_cycles / (F_CPU_HZ / 1000);
+}
+
+unsigned long OrangutanTime::ticks()
+{
+	return sim_cycles / CYCLES_PER_TICK;
+}
+
+// Brings timer2 and the tick count kept by its overflow interrupt up to
+// the current time.  The overflow interrupt is never pending because it is
+// taken as soon as TCNT2 wraps.
+static void updateTimer2()
+{
+	unsigned long ticks = sim_cycles / CYCLES_PER_TICK;
+	TCNT2 = ticks & 0xFF;
+	tickCount = ticks & ~0xFFUL;
+	TIFR2 = 0;
+}
+
+// Handles the next byte arriving or finishing transmission, if that
+// happens by the given time, and returns 1 if there was one.
+static char nextEvent(unsigned long long until)
+{
+	if (rx_next <= until && rx_next <= tx_shift_end)
+	{
+		sim_cycles = rx_next;
+		rx_next += byte_cycles;
+		if (rx_count == 2)
+		{
+			rx_overruns++;
+			rx_dor = 1;
+		}
+		else
+			rx_fifo[rx_count++] = rx_script ? rx_script[rx_sent] : rx_sequence;
+		rx_sequence++;
+		rx_sent++;
+		if (rx_script && rx_sent == rx_script_size)
+			rx_next = NEVER;
+		return 1;
+	}
+
+	if (tx_shift_end <= until)
+	{
+		sim_cycles = tx_shift_end;
+		tx_shift_end = NEVER;
+		if (tx_buffer_full)
+		{
+			tx_buffer_full = 0;
+			startShift(tx_buffer);
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+// Runs the interrupt that is pending, if any, and returns its cost in
+// cycles.
+static unsigned int takeInterrupt()
+{
+	struct timespec start, end;
+	unsigned int cycles;
+
+	updateTimer2();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	in_isr = 1;
+	if ((ucsr0b & (1 << RXCIE0)) && rx_count)
+	{
+		rx_isrs++;
+		USART_RX_vect();
+		cycles = RX_ISR_CYCLES;
+	}
+	else if ((ucsr0b & (1 << UDRIE0)) && !tx_buffer_full)
+	{
+		udre_isrs++;
+		USART_UDRE_vect();
+		cycles = UDRE_ISR_CYCLES;
+	}
+	else
+		cycles = 0;
+	in_isr = 0;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (cycles)
+		isr_host_ns += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	return cycles;
+}
+
+// Lets the given number of cycles of main loop code run, taking the
+// interrupts that happen in the meantime.  The time an interrupt takes
+// delays the interrupted code.
+static void advance(unsigned long cycles)
+{
+	unsigned long long until = sim_cycles + cycles;
+
+	while (1)
+	{
+		unsigned int isr_cycles = takeInterrupt();
+		if (isr_cycles)
+		{
+			// no other interrupt can be taken until this one returns
+			unsigned long long isr_end = sim_cycles + isr_cycles;
+			while (nextEvent(isr_end));
+			sim_cycles = isr_end;
+			until += isr_cycles;
+			continue;
+		}
+
+		if (!nextEvent(until))
+			break;
+	}
+	sim_cycles = until;
+	updateTimer2();
+}
+
+
+#define TX_SEND 0
+#define TX_QUEUE 1
+#define TX_SEGMENTS 2
+
+static const char *method_names[] = { "send", "queue", "segments" };
+
+#ifdef _SERIAL_INDEX_16BIT
+#define MAX_SIZE 1024
+#else
+#define MAX_SIZE 255
+#endif
+
+// source[i] is the low byte of the sequence number i, so the bytes
+// following any sequence number can be sent straight from it.
+static char source[256 + MAX_SIZE];
+static char ring[MAX_SIZE];
+static char queue[MAX_SIZE];
+
+static unsigned int run(unsigned char mode, unsigned long baud, SerialIndex size,
+	unsigned int work, unsigned char method, char strict)
+{
+	SerialIndex read_index = 0;
+	unsigned char expected = 0, tx_next = 0;
+	unsigned long received = 0, lost = 0, disorder = 0;
+	unsigned char chunk = size / 2 < 8 ? size / 2 : 8;
+	SerialSegment segments[3];
+	unsigned int failures = 0;
+
+	sim_cycles = 0;
+	rx_next = NEVER;
+	rx_count = 0;
+	rx_dor = 0;
+	rx_sequence = 0;
+	rx_sent = 0;
+	rx_overruns = 0;
+	tx_buffer_full = 0;
+	tx_shift_end = NEVER;
+	tx_expected = 0;
+	tx_bytes = 0;
+	tx_errors = 0;
+	rx_isrs = udre_isrs = 0;
+	isr_host_ns = 0;
+
+	OrangutanSerial::send(source, 0);	// drop anything left from the last run
+	if (method == TX_QUEUE)
+		OrangutanSerial::setSendQueue(queue, size);
+	else
+		OrangutanSerial::setSendQueue(0, 0);
+	OrangutanSerial::setMode(mode);
+	OrangutanSerial::setBaudRate(baud);
+	OrangutanSerial::receiveRing(ring, size);
+	byte_cycles = 16UL * (UBRR0 + 1) * 10;
+	rx_next = byte_cycles;
+
+	while (sim_cycles < SIM_CYCLES)
+	{
+		advance(work);
+
+		if (mode == SERIAL_CHECK)
+			OrangutanSerial::check();
+
+		// take the new bytes out of the ring
+		while (read_index != OrangutanSerial::getReceivedBytes())
+		{
+			unsigned char byte = ring[read_index];
+			if (++read_index >= size)
+				read_index = 0;
+
+			unsigned char gap = byte - expected;
+			if (gap >= 128)
+				disorder++;
+			else
+			{
+				lost += gap;
+				received++;
+				expected = byte + 1;
+			}
+		}
+
+		// keep the transmitter busy
+		if (method == TX_QUEUE)
+		{
+			while (OrangutanSerial::getSendQueueSpace() >= chunk)
+			{
+				OrangutanSerial::queueSend(source + tx_next, chunk);
+				tx_next += chunk;
+			}
+		}
+		else if (OrangutanSerial::sendBufferEmpty())
+		{
+			if (method == TX_SEND)
+				OrangutanSerial::send(source + tx_next, size);
+			else
+			{
+				// a header, a payload, and a trailer, as from separate buffers
+				SerialIndex quarter = size / 4;
+				segments[0].buffer = source + tx_next;
+				segments[0].size = quarter;
+				segments[1].buffer = source + tx_next + quarter;
+				segments[1].size = size - 2 * quarter;
+				segments[2].buffer = source + tx_next + size - quarter;
+				segments[2].size = quarter;
+				OrangutanSerial::sendSegments(segments, 3);
+			}
+			tx_next += size;
+		}
+	}
+
+	double seconds = (double)sim_cycles / F_CPU_HZ;
+	double line = (double)F_CPU_HZ / byte_cycles;
+	unsigned long isrs = rx_isrs + udre_isrs;
+	unsigned long bytes = rx_sent + tx_bytes;
+	double isr_load = (double)(rx_isrs * RX_ISR_CYCLES + udre_isrs * UDRE_ISR_CYCLES) / sim_cycles;
+
+	printf("%-9s %6lu %4u %6u %-8s %7.0f %5lu %5lu %7.0f %5.1f %5.2f %5.1f %7.0f\n",
+		mode == SERIAL_AUTOMATIC ? "automatic" : "check", baud, size, work, method_names[method],
+		received / seconds, lost, rx_overruns, tx_bytes / seconds, 100 * tx_bytes / seconds / line,
+		(double)isrs / bytes, 100 * isr_load, isrs ? isr_host_ns / isrs : 0.0);
+
+	if (disorder || tx_errors)
+	{
+		printf("  %lu bytes received out of order, %lu bytes corrupted on the wire\n", disorder, tx_errors);
+		failures++;
+	}
+	if (strict && (lost || tx_bytes / seconds < 0.95 * line))
+	{
+		printf("  should not lose bytes or let the transmitter idle\n");
+		failures++;
+	}
+	return failures;
+}
+
+// Receives for a while in SERIAL_AUTOMATIC mode with timestamps and
+// checks that each byte's timestamp is between the time its stop bit
+// ended and a byte time after that, which is when the next byte would
+// overrun the FIFO.  The transmitter is kept busy as in the benchmark, so
+// a receive interrupt that has to wait for a transmit interrupt shows up
+// in the largest latency, which is printed in microseconds.
+static unsigned int checkTimestamps()
+{
+	static unsigned long times[32];
+	SerialIndex read_index = 0;
+	unsigned long received = 0, max_latency = 0, bad = 0;
+	unsigned char tx_next = 0;
+
+	sim_cycles = 0;
+	rx_next = NEVER;
+	rx_count = 0;
+	rx_dor = 0;
+	rx_sequence = 0;
+	rx_sent = 0;
+	rx_overruns = 0;
+	tx_buffer_full = 0;
+	tx_shift_end = NEVER;
+	tx_expected = 0;
+
+	OrangutanSerial::send(source, 0);
+	OrangutanSerial::setSendQueue(0, 0);
+	OrangutanSerial::setMode(SERIAL_AUTOMATIC);
+	OrangutanSerial::setBaudRate(115200);
+	OrangutanSerial::receiveRing(ring, 32);
+	OrangutanSerial::setReceiveTimestamps(times);
+	byte_cycles = 16UL * (UBRR0 + 1) * 10;
+	rx_next = byte_cycles;
+
+	while (sim_cycles < SIM_CYCLES)
+	{
+		advance(1000);
+
+		while (read_index != OrangutanSerial::getReceivedBytes())
+		{
+			unsigned long arrival = (received + 1) * byte_cycles / CYCLES_PER_TICK;
+			unsigned long latency = times[read_index] - arrival;
+			if ((unsigned char)ring[read_index] != (unsigned char)received || latency > byte_cycles / CYCLES_PER_TICK)
+				bad++;
+			else if (latency > max_latency)
+				max_latency = latency;
+			if (++read_index >= 32)
+				read_index = 0;
+			received++;
+		}
+
+		if (OrangutanSerial::sendBufferEmpty())
+		{
+			OrangutanSerial::send(source + tx_next, 32);
+			tx_next += 32;
+		}
+	}
+
+	printf("timestamps: %lu bytes at 115200 baud, largest latency %.1f us\n",
+		received, max_latency * CYCLES_PER_TICK * 1e6 / F_CPU_HZ);
+	if (bad || received == 0)
+	{
+		printf("  %lu bytes with a missing or wrong timestamp\n", bad);
+		return 1;
+	}
+	return 0;
+}
+
+// Resets the simulation for a run at 115200 baud in SERIAL_AUTOMATIC mode
+// in which the host sends the given bytes once and the bytes the library
+// transmits are stored in log.  The caller sets up the receiving.
+static void startScript(const unsigned char *script, unsigned int size, unsigned char *log,
+	unsigned int log_size)
+{
+	sim_cycles = 0;
+	rx_next = NEVER;
+	rx_count = 0;
+	rx_dor = 0;
+	rx_sequence = 0;
+	rx_sent = 0;
+	rx_overruns = 0;
+	rx_script = script;
+	rx_script_size = size;
+	tx_buffer_full = 0;
+	tx_shift_end = NEVER;
+	tx_bytes = 0;
+	tx_errors = 0;
+	tx_log = log;
+	tx_log_size = log_size;
+
+	OrangutanSerial::send(source, 0);
+	OrangutanSerial::setSendQueue(0, 0);
+	OrangutanSerial::setMode(SERIAL_AUTOMATIC);
+	OrangutanSerial::setBaudRate(115200);
+	byte_cycles = 16UL * (UBRR0 + 1) * 10;
+	if (size)
+		rx_next = byte_cycles;
+}
+
+// Returns the simulation to the sequence numbers used by the benchmark.
+static void stopScript()
+{
+	rx_script = 0;
+	tx_log = 0;
+}
+
+// CRC-8 with polynomial 0x07, as checked by SERIAL_FRAMING_CRC8.
+static unsigned char crc8(const unsigned char *data, unsigned char length)
+{
+	unsigned char crc = 0, i;
+	while (length--)
+	{
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+	}
+	return crc;
+}
+
+// Encodes a frame for the given framing mode into out and returns its
+// length.  With SERIAL_FRAMING_CRC8, the CRC is appended first, inverted
+// if bad_crc is set.
+static unsigned int encodeFrame(unsigned char framing, const unsigned char *payload,
+	unsigned char length, char bad_crc, unsigned char *out)
+{
+	unsigned char data[256];
+	unsigned int n = 0, i;
+
+	for (i = 0; i < length; i++)
+		data[i] = payload[i];
+	if (framing & SERIAL_FRAMING_CRC8)
+	{
+		data[length] = crc8(payload, length) ^ (bad_crc ? 0xFF : 0);
+		length++;
+	}
+
+	switch (framing & ~SERIAL_FRAMING_CRC8)
+	{
+	case SERIAL_FRAMING_LINE:
+		for (i = 0; i < length; i++)
+			out[n++] = data[i];
+		out[n++] = '\n';
+		break;
+
+	case SERIAL_FRAMING_SLIP:
+		out[n++] = 0xC0;
+		for (i = 0; i < length; i++)
+		{
+			if (data[i] == 0xC0 || data[i] == 0xDB)
+			{
+				out[n++] = 0xDB;
+				out[n++] = data[i] == 0xC0 ? 0xDC : 0xDD;
+			}
+			else
+				out[n++] = data[i];
+		}
+		out[n++] = 0xC0;
+		break;
+
+	case SERIAL_FRAMING_COBS:
+	{
+		unsigned int code_index = n++;
+		unsigned char code = 1;
+		for (i = 0; i < length; i++)
+		{
+			if (data[i] == 0)
+			{
+				out[code_index] = code;
+				code_index = n++;
+				code = 1;
+			}
+			else
+			{
+				out[n++] = data[i];
+				if (++code == 0xFF)
+				{
+					out[code_index] = code;
+					code_index = n++;
+					code = 1;
+				}
+			}
+		}
+		out[code_index] = code;
+		out[n++] = 0;
+		break;
+	}
+	}
+	return n;
+}
+
+// Receives a stream of frames with receiveFrames() and getFrame() in each
+// framing mode, with and without a CRC, with a buffer for two 32-byte
+// frames.  The stream has a short frame, one with every byte the framing
+// modes treat specially (except the line end), one that is too long,
+// one with a bad CRC (if there is a CRC), one that just fits, and a
+// short one to show that the decoder recovered.  Returns the number of
+// modes in which the good frames do not all come out intact and in order,
+// or the two bad frames are not counted by getFrameErrors().
+static unsigned int checkFraming()
+{
+	static const unsigned char framings[] = { SERIAL_FRAMING_LINE, SERIAL_FRAMING_SLIP,
+		SERIAL_FRAMING_COBS };
+	static const char *names[] = { "line", "SLIP", "COBS" };
+	static const unsigned char special[] = { 0x00, 0xC0, 0xDB, 0x01, 0xDC, 0xDD, 0x7F, 0x00, 0xFF };
+	static unsigned char script[512];
+	static char buffer[64];
+	unsigned char payloads[6][40];
+	unsigned char lengths[6];
+	unsigned int failures = 0;
+	unsigned char f, crc, i;
+
+	for (f = 0; f < 3; f++)
+	{
+		for (crc = 0; crc < 2; crc++)
+		{
+			unsigned char framing = framings[f] | (crc ? SERIAL_FRAMING_CRC8 : 0);
+			unsigned char expected = 0, ok = 1;
+			unsigned int size = 0;
+
+			// the frames, as in the comment above
+			lengths[0] = 5;
+			for (i = 0; i < 5; i++)
+				payloads[0][i] = "hello"[i];
+			lengths[1] = sizeof(special);
+			for (i = 0; i < sizeof(special); i++)
+				payloads[1][i] = special[i];
+			lengths[2] = 40;
+			lengths[4] = crc ? 31 : 32;
+			for (i = 0; i < 40; i++)
+				payloads[2][i] = payloads[4][i] = 'a' + i % 26;
+			lengths[5] = 3;
+			for (i = 0; i < 3; i++)
+				payloads[5][i] = "bye"[i];
+
+			for (i = 0; i < 6; i++)
+			{
+				if (i == 3)
+				{
+					if (crc)
+						size += encodeFrame(framing, payloads[0], lengths[0], 1, script + size);
+					continue;
+				}
+				size += encodeFrame(framing, payloads[i], lengths[i], 0, script + size);
+			}
+
+			startScript(script, size, 0, 0);
+			OrangutanSerial::receiveFrames(framing, buffer, sizeof(buffer), 0);
+			while (sim_cycles < (size + 2) * byte_cycles)
+			{
+				advance(1000);
+
+				unsigned char length;
+				char *frame;
+				while ((frame = OrangutanSerial::getFrame(&length)) != 0)
+				{
+					// skip the frames that must be dropped
+					while (expected == 2 || expected == 3)
+						expected++;
+					if (expected > 5 || length != lengths[expected])
+						ok = 0;
+					else
+					{
+						for (i = 0; i < length; i++)
+							if ((unsigned char)frame[i] != payloads[expected][i])
+								ok = 0;
+					}
+					expected++;
+					OrangutanSerial::releaseFrame();
+				}
+			}
+			unsigned char errors = OrangutanSerial::getFrameErrors();
+			if (expected != 6 || errors != 1 + crc)
+				ok = 0;
+
+			printf("framing: %s %s: %u frames, %u dropped  %s\n", names[f],
+				crc ? "with CRC   " : "without CRC", expected - 2, errors, ok ? "ok" : "FAIL");
+			if (!ok)
+				failures++;
+		}
+	}
+
+	OrangutanSerial::receiveFrames(SERIAL_FRAMING_NONE, 0, 0, 0);
+	stopScript();
+	return failures;
+}
+
+// What the command handlers and the error handler saw, one line per call.
+static char command_log[256];
+static unsigned int command_log_length;
+
+static void logCommand(const unsigned char *arguments, unsigned char length)
+{
+	// the command byte is not passed, so each handler has its own letter
+	command_log_length += sprintf(command_log + command_log_length, "%u:", length);
+	while (length--)
+		command_log_length += sprintf(command_log + command_log_length, " %02x", *arguments++);
+	command_log_length += sprintf(command_log + command_log_length, "\n");
+}
+
+static void commandA(const unsigned char *arguments, unsigned char length)
+{
+	command_log[command_log_length++] = 'A';
+	logCommand(arguments, length);
+}
+
+static void commandB(const unsigned char *arguments, unsigned char length)
+{
+	command_log[command_log_length++] = 'B';
+	logCommand(arguments, length);
+}
+
+static void commandC(const unsigned char *arguments, unsigned char length)
+{
+	command_log[command_log_length++] = 'C';
+	logCommand(arguments, length);
+}
+
+static void commandError(unsigned char error, unsigned char byte)
+{
+	command_log_length += sprintf(command_log + command_log_length, "error %u %02x\n", error, byte);
+}
+
+// Sends a stream of commands and calls OrangutanSerialCommands::check(),
+// either every 500 cycles, so that most commands are split across calls,
+// or once after the whole stream has arrived.  The stream has fixed and
+// variable length commands, an unknown command, a variable length
+// command that is too long for the 8-byte argument buffer, a stray data
+// byte, and a command cut short by the next one.  Then reply() is tried
+// with no send queue, with a queue that is too full for the reply, and
+// with a reply larger than the queue.  Returns the number of cases in
+// which the handlers, the errors, or the bytes on the wire are not as
+// expected.
+static unsigned int checkCommands()
+{
+	static const SerialCommand commands[] = {
+		{ 0x81, 2, commandA },
+		{ 0x82, 0, commandB },
+		{ 0x83, SERIAL_COMMAND_VARIABLE_LENGTH, commandC },
+	};
+	static const unsigned char script[] = {
+		0x81, 0x01, 0x02,
+		0x82,
+		0x83, 0x03, 0x0a, 0x0b, 0x0c,
+		0x90, 0x05, 0x06,
+		0x81, 0x03, 0x04,
+		0x83, 0x09, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+		0x82,
+		0x83, 0x00,
+		0x05,
+		0x81, 0x07,
+		0x82,
+	};
+	static const char *expected =
+		"A2: 01 02\n"
+		"B0:\n"
+		"C3: 0a 0b 0c\n"
+		"error 1 90\n"
+		"A2: 03 04\n"
+		"error 4 83\n"
+		"B0:\n"
+		"C0:\n"
+		"error 3 05\n"
+		"error 2 81\n"
+		"B0:\n";
+	static char ring[64];
+	static char queue[8];
+	static unsigned char wire[32];
+	unsigned char arguments[8];
+	unsigned int failures = 0;
+	unsigned char split;
+
+	for (split = 0; split < 2; split++)
+	{
+		unsigned int handled = 0;
+
+		startScript(script, sizeof(script), 0, 0);
+		OrangutanSerialCommands::init(commands, 3, ring, sizeof(ring), arguments, sizeof(arguments));
+		OrangutanSerialCommands::setErrorHandler(commandError);
+		command_log_length = 0;
+		while (sim_cycles < (sizeof(script) + 2) * byte_cycles)
+		{
+			advance(split ? 500 : (sizeof(script) + 2) * byte_cycles);
+			handled += OrangutanSerialCommands::check();
+		}
+		command_log[command_log_length] = 0;
+
+		unsigned char ok = strcmp(command_log, expected) == 0 && handled == 7;
+		printf("commands: %-34s %u handled  %s\n", split ? "checked every 500 cycles" :
+			"checked once", handled, ok ? "ok" : "FAIL");
+		if (!ok)
+		{
+			printf("%s", command_log);
+			failures++;
+		}
+	}
+
+	// the replies
+	static const char *reply_names[] = { "reply without a send queue", "reply to a full send queue",
+		"reply larger than the send queue" };
+	for (split = 0; split < 3; split++)
+	{
+		const char *queued = split == 1 ? "01234" : split == 2 ? "01" : "";
+		const char *reply = split == 2 ? "abcdefghij" : "abcd";
+		char sent[32];
+
+		startScript(0, 0, wire, sizeof(wire));
+		OrangutanSerialCommands::init(commands, 3, ring, sizeof(ring), arguments, sizeof(arguments));
+		if (split)
+		{
+			OrangutanSerial::setSendQueue(queue, sizeof(queue));
+			OrangutanSerial::queueSend(queued, strlen(queued));
+		}
+		OrangutanSerialCommands::reply(reply, strlen(reply));
+		unsigned long at_return = tx_bytes;
+		advance(40 * byte_cycles);
+
+		sprintf(sent, "%s%s", queued, reply);
+		unsigned char ok = tx_bytes == strlen(sent) && memcmp(wire, sent, tx_bytes) == 0;
+		// the reply to the full queue must be queued rather than sent blocking
+		if (split == 1 && at_return >= strlen(sent) - 1)
+			ok = 0;
+		printf("commands: %-34s %2lu bytes sent  %s\n", reply_names[split], tx_bytes, ok ? "ok" : "FAIL");
+		if (!ok)
+			failures++;
+	}
+
+	OrangutanSerial::setSendQueue(0, 0);
+	OrangutanSerial::cancelReceive();
+	stopScript();
+	return failures;
+}
+
+static void header()
+{
+	printf("%-9s %6s %4s %6s %-8s %7s %5s %5s %7s %5s %5s %5s %7s\n", "mode", "baud", "size",
+		"work", "tx", "rx B/s", "lost", "dor", "tx B/s", "tx %", "isr/B", "isr %", "host ns");
+}
+
+int main()
+{
+	static const unsigned long bauds[] = { 115200, 250000, 500000 };
+#ifdef _SERIAL_INDEX_16BIT
+	static const SerialIndex sizes[] = { 8, 32, 128, 1024 };
+#else
+	static const SerialIndex sizes[] = { 8, 32, 128 };
+#endif
+	static const unsigned int works[] = { 1000, 10000 };
+	unsigned int i, b, s, w, m, failures = 0;
+
+	for (i = 0; i < sizeof(source); i++)
+		source[i] = i;
+
+	// Buffer sizes, with the send queue, for light and heavy main loops.
+	// work is the number of CPU cycles between main loop iterations.
+	printf("isr %% assumes %u cycles per receive interrupt and %u per UDRE interrupt;\n"
+		"these are assumed inputs, not measurements of the compiled ISRs\n\n",
+		RX_ISR_CYCLES, UDRE_ISR_CYCLES);
+	header();
+	for (i = 0; i < 2; i++)
+		for (b = 0; b < 3; b++)
+			for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+				for (w = 0; w < 2; w++)
+					failures += run(i ? SERIAL_CHECK : SERIAL_AUTOMATIC, bauds[b], sizes[s], works[w],
+						TX_QUEUE, !i && sizes[s] >= 32 && works[w] <= 1000);
+
+	// The ways of sending, with 32-byte buffers.
+	printf("\n");
+	header();
+	for (i = 0; i < 2; i++)
+		for (b = 0; b < 3; b++)
+			for (m = 0; m < 3; m++)
+				failures += run(i ? SERIAL_CHECK : SERIAL_AUTOMATIC, bauds[b], 32, 1000, m, 0);
+
+	printf("\n");
+	failures += checkTimestamps();
+	failures += checkFraming();
+	failures += checkCommands();
+
+	return failures ? 1 : 0;
+}
+
+// Local Variables: **
+// mode: C++ **
+// c-basic-offset: 4 **
+// tab-width: 4 **
+// indent-tabs-mode: t **
+// end: **